@@ -0,0 +1,772 @@
+// 提取流水线的基准测试
+// 分别测量解码、像素转换、JPEG 编码、文件写入各阶段以及端到端的吞吐量和 CPU 时间，
+// 输入为 video/ 下自带的环视视频或合成的 YUV 帧；shm 阶段同时是共享内存消费端的使用示例
+#define RESTORE_NO_MAIN
+#include "restore.cpp"
+
+namespace {
+
+// 进程累计的 CPU 时间(用户态 + 内核态)，单位秒
+double process_cpu_seconds() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0.0;
+    }
+    auto to_seconds = [](const FILETIME& t) {
+        ULARGE_INTEGER v;
+        v.LowPart = t.dwLowDateTime;
+        v.HighPart = t.dwHighDateTime;
+        return static_cast<double>(v.QuadPart) / 1e7;
+    };
+    return to_seconds(kernel) + to_seconds(user);
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+// 一次测量的结果
+struct BenchResult {
+    std::string name;
+    std::string config;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    double wall_seconds = 0.0;
+    double cpu_seconds = 0.0;
+
+    double fps() const { return wall_seconds > 0 ? frames / wall_seconds : 0.0; }
+};
+
+// 计时区间: 构造时记录起点，stop 时填写结果
+class BenchTimer {
+public:
+    BenchTimer() : wall_start_(SteadyClock::now()), cpu_start_(process_cpu_seconds()) {}
+
+    void stop(BenchResult& result) const {
+        result.wall_seconds = std::chrono::duration<double>(SteadyClock::now() - wall_start_).count();
+        result.cpu_seconds = process_cpu_seconds() - cpu_start_;
+    }
+
+private:
+    SteadyClock::time_point wall_start_;
+    double cpu_start_;
+};
+
+// 基准测试参数
+struct BenchOptions {
+    std::vector<std::string> videos;
+    std::string work_dir = "bench_output";
+    int frames = 30;                          // 单阶段测试使用的内存帧数
+    int synthetic_width = 0;                  // 大于 0 时使用合成帧代替视频
+    int synthetic_height = 0;
+    std::vector<int> threads = {1, 2, 4};
+    std::vector<int> qualities = {50, 75, 95};
+    std::vector<std::string> stages = {"decode", "convert", "encode", "compare", "write", "e2e", "shm"};
+    std::string jpeg_backend = "ffmpeg";
+    std::vector<std::string> output_formats = {"jpeg"};  // 端到端测试的输出格式
+    std::string json_path;
+};
+
+// 打开视频并创建解码器，失败时返回 false
+bool open_decoder(const std::string& path, int threads, AVFormatContext** format_ctx,
+                  AVCodecContext** codec_ctx, int* stream_index) {
+    if (avformat_open_input(format_ctx, path.c_str(), nullptr, nullptr) != 0 ||
+        avformat_find_stream_info(*format_ctx, nullptr) < 0) {
+        std::cerr << "无法打开视频文件: " << path << std::endl;
+        avformat_close_input(format_ctx);
+        return false;
+    }
+    const AVCodec* codec = nullptr;
+    *stream_index = av_find_best_stream(*format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (*stream_index < 0 || !codec) {
+        std::cerr << "未找到视频流或解码器: " << path << std::endl;
+        avformat_close_input(format_ctx);
+        return false;
+    }
+    *codec_ctx = avcodec_alloc_context3(codec);
+    if (!*codec_ctx ||
+        avcodec_parameters_to_context(*codec_ctx, (*format_ctx)->streams[*stream_index]->codecpar) < 0) {
+        avcodec_free_context(codec_ctx);
+        avformat_close_input(format_ctx);
+        return false;
+    }
+    (*codec_ctx)->thread_count = threads;
+    (*codec_ctx)->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    if (avcodec_open2(*codec_ctx, codec, nullptr) < 0) {
+        std::cerr << "无法打开解码器: " << path << std::endl;
+        avcodec_free_context(codec_ctx);
+        avformat_close_input(format_ctx);
+        return false;
+    }
+    return true;
+}
+
+// 解码视频；max_frames 大于 0 时只解码前 max_frames 帧并把它们保存在 keep 中
+uint64_t decode_video(const std::string& path, int threads, int max_frames,
+                      std::vector<AVFrame*>* keep) {
+    AVFormatContext* format_ctx = nullptr;
+    AVCodecContext* codec_ctx = nullptr;
+    int stream_index = -1;
+    if (!open_decoder(path, threads, &format_ctx, &codec_ctx, &stream_index)) {
+        return 0;
+    }
+
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    uint64_t count = 0;
+    bool done = false;
+    auto drain = [&]() {
+        while (!done && avcodec_receive_frame(codec_ctx, frame) >= 0) {
+            count++;
+            if (keep) {
+                keep->push_back(av_frame_clone(frame));
+            }
+            av_frame_unref(frame);
+            done = max_frames > 0 && count >= static_cast<uint64_t>(max_frames);
+        }
+    };
+    while (!done && av_read_frame(format_ctx, packet) >= 0) {
+        if (packet->stream_index == stream_index && avcodec_send_packet(codec_ctx, packet) >= 0) {
+            drain();
+        }
+        av_packet_unref(packet);
+    }
+    if (!done) {
+        avcodec_send_packet(codec_ctx, nullptr);
+        drain();
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&codec_ctx);
+    avformat_close_input(&format_ctx);
+    return count;
+}
+
+// 生成带渐变和伪随机噪声的合成帧，使编码负载接近真实画面
+std::vector<AVFrame*> make_synthetic_frames(int width, int height, AVPixelFormat format, int count) {
+    std::vector<AVFrame*> frames;
+    uint32_t seed = 12345;
+    for (int n = 0; n < count; n++) {
+        AVFrame* frame = av_frame_alloc();
+        frame->format = format;
+        frame->width = width;
+        frame->height = height;
+        if (av_frame_get_buffer(frame, 0) < 0) {
+            av_frame_free(&frame);
+            break;
+        }
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+        for (int plane = 0; plane < av_pix_fmt_count_planes(format); plane++) {
+            int plane_height = plane == 0 ? height : AV_CEIL_RSHIFT(height, desc->log2_chroma_h);
+            int row_bytes = std::abs(frame->linesize[plane]);
+            for (int y = 0; y < plane_height; y++) {
+                uint8_t* row = frame->data[plane] + y * frame->linesize[plane];
+                for (int x = 0; x < row_bytes; x++) {
+                    seed = seed * 1664525u + 1013904223u;
+                    row[x] = static_cast<uint8_t>(((x + y + n * 4) & 0xFF) / 2 + ((seed >> 24) & 0x3F));
+                }
+            }
+        }
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+void free_frames(std::vector<AVFrame*>& frames) {
+    for (auto& frame : frames) {
+        av_frame_free(&frame);
+    }
+    frames.clear();
+}
+
+// 取得单阶段测试用的内存帧
+std::vector<AVFrame*> load_frames(const BenchOptions& options, AVPixelFormat synthetic_format) {
+    if (options.synthetic_width > 0) {
+        return make_synthetic_frames(options.synthetic_width, options.synthetic_height,
+                                     synthetic_format, options.frames);
+    }
+    std::vector<AVFrame*> frames;
+    if (!options.videos.empty()) {
+        decode_video(options.videos.front(), 0, options.frames, &frames);
+    }
+    return frames;
+}
+
+// JPEG 编码器只接受全范围的原生格式帧，与流水线的转换阶段一样先用 converter 转换其余的帧
+// 转换后的帧来自 converter 的缓冲池，converter 须比这些帧存活更久
+void convert_for_jpeg(std::vector<AVFrame*>& frames, FrameConverter& converter) {
+    for (auto& frame : frames) {
+        if (!is_jpeg_native_frame(frame)) {
+            AVFrame* converted = converter.convert(frame);
+            av_frame_free(&frame);
+            frame = converted;
+        }
+    }
+    frames.erase(std::remove(frames.begin(), frames.end(), nullptr), frames.end());
+}
+
+// 解码阶段: 完整解码每个视频，不做任何输出
+void bench_decode(const BenchOptions& options, std::vector<BenchResult>& results) {
+    if (options.videos.empty()) {
+        return;
+    }
+    for (int threads : options.threads) {
+        BenchResult result{"decode", "threads=" + std::to_string(threads)};
+        BenchTimer timer;
+        for (const auto& video : options.videos) {
+            result.frames += decode_video(video, threads, 0, nullptr);
+        }
+        timer.stop(result);
+        results.push_back(result);
+    }
+}
+
+// 像素转换阶段: NV12 (硬件解码下载后的典型格式) 转全范围 YUV420P
+void bench_convert(const BenchOptions& options, std::vector<BenchResult>& results) {
+    std::vector<AVFrame*> source = load_frames(options, AV_PIX_FMT_NV12);
+    if (source.empty()) {
+        return;
+    }
+
+    // 视频帧通常已是 4:2:0 平面格式，先转成 NV12 作为转换输入
+    std::vector<AVFrame*> frames;
+    SwsContext* to_nv12 = nullptr;
+    for (AVFrame* src : source) {
+        if (src->format == AV_PIX_FMT_NV12) {
+            frames.push_back(av_frame_clone(src));
+            continue;
+        }
+        to_nv12 = sws_getCachedContext(to_nv12, src->width, src->height,
+                                       static_cast<AVPixelFormat>(src->format),
+                                       src->width, src->height, AV_PIX_FMT_NV12,
+                                       SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+        AVFrame* nv12 = av_frame_alloc();
+        nv12->format = AV_PIX_FMT_NV12;
+        nv12->width = src->width;
+        nv12->height = src->height;
+        av_frame_get_buffer(nv12, 0);
+        sws_scale(to_nv12, src->data, src->linesize, 0, src->height, nv12->data, nv12->linesize);
+        frames.push_back(nv12);
+    }
+    sws_freeContext(to_nv12);
+    free_frames(source);
+
+    FrameConverter converter;
+    BenchResult result{"convert", "nv12->yuv420p"};
+    BenchTimer timer;
+    for (int pass = 0; pass < 3; pass++) {
+        for (AVFrame* frame : frames) {
+            AVFrame* converted = converter.convert(frame);
+            if (converted) {
+                result.frames++;
+            }
+            av_frame_free(&converted);
+        }
+    }
+    timer.stop(result);
+    results.push_back(result);
+    free_frames(frames);
+}
+
+// JPEG 编码阶段: 不同质量参数和编码线程数
+void bench_encode(const BenchOptions& options, std::vector<BenchResult>& results) {
+    FrameConverter converter;
+    std::vector<AVFrame*> frames = load_frames(options, AV_PIX_FMT_YUV420P);
+    convert_for_jpeg(frames, converter);
+    if (frames.empty()) {
+        return;
+    }
+    for (int quality : options.qualities) {
+        for (int threads : options.threads) {
+            BenchResult result{"encode", options.jpeg_backend + " quality=" + std::to_string(quality) +
+                                         " threads=" + std::to_string(threads)};
+            std::atomic<uint64_t> bytes{0};
+            std::atomic<uint64_t> encoded{0};
+            BenchTimer timer;
+            // 每个线程持有独立的编码器，轮流编码同一组帧
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; t++) {
+                workers.emplace_back([&, t]() {
+                    std::unique_ptr<FrameEncoder> encoder =
+                        create_jpeg_encoder(options.jpeg_backend, quality, 1);
+                    for (size_t i = t; i < frames.size(); i += threads) {
+                        AVPacket* pkt = encoder->encode(frames[i]);
+                        if (pkt) {
+                            bytes += pkt->size;
+                            encoded++;
+                        }
+                    }
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            timer.stop(result);
+            result.frames = encoded;
+            result.bytes = bytes;
+            results.push_back(result);
+        }
+    }
+    free_frames(frames);
+}
+
+#ifdef RESTORE_WITH_TURBOJPEG
+// 用 FFmpeg 解码一帧 JPEG，失败时返回 nullptr
+AVFrame* decode_jpeg(const AVPacket* pkt) {
+    const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+    AVCodecContext* ctx = codec ? avcodec_alloc_context3(codec) : nullptr;
+    AVFrame* frame = av_frame_alloc();
+    if (!ctx || !frame || avcodec_open2(ctx, codec, nullptr) < 0 || avcodec_send_packet(ctx, pkt) < 0 ||
+        avcodec_receive_frame(ctx, frame) < 0) {
+        av_frame_free(&frame);
+    }
+    avcodec_free_context(&ctx);
+    return frame;
+}
+
+// 两个 JPEG 后端对同一帧的输出应当是同一幅画面: 解码后比较亮度平面的平均绝对差
+// 色彩范围处理不一致时差值在 10 以上(整幅画面发灰)，质量参数和 DCT 实现的差别远小于阈值
+bool compare_jpeg_backends(const BenchOptions& options, std::vector<BenchResult>& results) {
+    constexpr double kMaxMeanDifference = 3.0;
+    FrameConverter converter;
+    std::vector<AVFrame*> frames = load_frames(options, AV_PIX_FMT_YUV420P);
+    convert_for_jpeg(frames, converter);
+    if (frames.empty()) {
+        return true;
+    }
+    const int quality = options.qualities.back();
+    JpegEncoder ffmpeg_encoder(quality);
+    TurboJpegEncoder turbo_encoder(quality);
+    double total_difference = 0.0;
+    uint64_t compared = 0;
+    for (AVFrame* frame : frames) {
+        AVFrame* decoded[2] = {};
+        FrameEncoder* encoders[2] = {&ffmpeg_encoder, &turbo_encoder};
+        for (int i = 0; i < 2; i++) {
+            if (AVPacket* pkt = encoders[i]->encode(frame)) {
+                decoded[i] = decode_jpeg(pkt);
+            }
+        }
+        if (decoded[0] && decoded[1] && decoded[0]->width == decoded[1]->width &&
+            decoded[0]->height == decoded[1]->height) {
+            uint64_t sum = 0;
+            for (int y = 0; y < decoded[0]->height; y++) {
+                const uint8_t* a = decoded[0]->data[0] + y * decoded[0]->linesize[0];
+                const uint8_t* b = decoded[1]->data[0] + y * decoded[1]->linesize[0];
+                for (int x = 0; x < decoded[0]->width; x++) {
+                    sum += static_cast<uint64_t>(std::abs(a[x] - b[x]));
+                }
+            }
+            total_difference += static_cast<double>(sum) / (decoded[0]->width * decoded[0]->height);
+            compared++;
+        }
+        av_frame_free(&decoded[0]);
+        av_frame_free(&decoded[1]);
+    }
+    free_frames(frames);
+
+    double mean_difference = compared > 0 ? total_difference / compared : 0.0;
+    char config[64];
+    std::snprintf(config, sizeof(config), "ffmpeg/turbojpeg quality=%d mad=%.2f", quality, mean_difference);
+    BenchResult result{"compare", config};
+    result.frames = compared;
+    results.push_back(result);
+    if (compared == 0 || mean_difference > kMaxMeanDifference) {
+        std::cerr << "JPEG 后端输出不一致: 亮度平均差 " << mean_difference << " (比较 " << compared
+                  << " 帧)" << std::endl;
+        return false;
+    }
+    return true;
+}
+#endif  // RESTORE_WITH_TURBOJPEG
+
+// 文件写入阶段: 同一组 JPEG 数据分别写入空设备和真实磁盘
+void bench_write(const BenchOptions& options, std::vector<BenchResult>& results) {
+    FrameConverter converter;
+    std::vector<AVFrame*> frames = load_frames(options, AV_PIX_FMT_YUV420P);
+    convert_for_jpeg(frames, converter);
+    if (frames.empty()) {
+        return;
+    }
+    std::vector<std::vector<uint8_t>> jpegs;
+    JpegEncoder encoder(options.qualities.front());
+    for (AVFrame* frame : frames) {
+        if (AVPacket* pkt = encoder.encode(frame)) {
+            jpegs.emplace_back(pkt->data, pkt->data + pkt->size);
+        }
+    }
+    free_frames(frames);
+
+    std::string dir = options.work_dir + "/write";
+    fs::create_directories(dir);
+#ifdef _WIN32
+    const std::string null_device = "NUL";
+#else
+    const std::string null_device = "/dev/null";
+#endif
+    for (bool to_disk : {false, true}) {
+        for (int threads : options.threads) {
+            BenchResult result{"write", std::string(to_disk ? "disk" : "null") +
+                                        " threads=" + std::to_string(threads)};
+            std::atomic<uint64_t> written{0};
+            std::atomic<uint64_t> bytes{0};
+            BenchTimer timer;
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; t++) {
+                workers.emplace_back([&, t]() {
+                    std::string error;
+                    for (int pass = 0; pass < 4; pass++) {
+                        for (size_t i = t; i < jpegs.size(); i += threads) {
+                            std::string path = to_disk
+                                ? dir + "/" + std::to_string(pass * jpegs.size() + i) + ".jpg"
+                                : null_device;
+                            if (write_file_fully(path, jpegs[i].data(), jpegs[i].size(), error)) {
+                                written++;
+                                bytes += jpegs[i].size();
+                            }
+                        }
+                    }
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            timer.stop(result);
+            result.frames = written;
+            result.bytes = bytes;
+            results.push_back(result);
+        }
+    }
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+}
+
+// 端到端: 使用与 restore 相同的 decode_video_to_images，变化输出格式、编码线程数、质量和输出方式
+void bench_end_to_end(const BenchOptions& options, std::vector<BenchResult>& results) {
+    struct OutputMode {
+        const char* name;
+        bool pack;
+        bool discard;
+    };
+    const OutputMode modes[] = {{"null", false, true}, {"files", false, false}, {"pack", true, false}};
+
+    for (const auto& video : options.videos) {
+        std::string txt = fs::path(video).replace_extension(".txt").string();
+        for (const auto& mode : modes) {
+            for (const auto& format : options.output_formats) {
+                for (int threads : options.threads) {
+                    for (int quality : options.qualities) {
+                        // 质量只影响 JPEG
+                        if (format != "jpeg" && quality != options.qualities.front()) {
+                            continue;
+                        }
+                        ExtractOptions extract;
+                        extract.output_format = format;
+                        extract.encode_threads = threads;
+                        extract.jpeg_quality = quality;
+                        extract.jpeg_backend = options.jpeg_backend;
+                        extract.pack_output = mode.pack;
+                        extract.discard_output = mode.discard;
+                        std::string out_dir = options.work_dir + "/e2e";
+                        fs::create_directories(out_dir);
+
+                        StreamStats stats;
+                        BenchResult result{"e2e", fs::path(video).stem().string() + " " + mode.name +
+                                                  " " + format + " threads=" + std::to_string(threads) +
+                                                  (format == "jpeg" ? " quality=" + std::to_string(quality) : "")};
+                        BenchTimer timer;
+                        decode_video_to_images(video, txt, out_dir, extract, &stats);
+                        timer.stop(result);
+                        result.frames = stats.frames_written;
+                        result.bytes = stats.bytes_written;
+                        results.push_back(result);
+
+                        std::error_code ec;
+                        fs::remove_all(out_dir, ec);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// 64 位 FNV-1a 校验和
+uint64_t fnv1a(const uint8_t* data, size_t size) {
+    uint64_t hash = 1469598103934665603ull;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// 共享内存发布: FrameReader 拉取解码帧，编码为原始 YUV420P 后发布到 restore_bench_<视频名>，
+// 消费线程用 SharedFrameSubscriber 直接在共享内存中读取并校验每帧的校验和；
+// 小环形缓冲区让消费端经常被覆盖，用来检验顺序锁。读到的数据与发布的不一致、
+// 帧数据没有按 64 字节对齐或一帧都没有读到时返回 false
+bool bench_shared_memory(const BenchOptions& options, std::vector<BenchResult>& results) {
+    bool ok = true;
+    for (const auto& video : options.videos) {
+        std::string txt = fs::path(video).replace_extension(".txt").string();
+        std::string camera = fs::path(video).stem().string();
+        int width = 0;
+        int height = 0;
+        if (!probe_video_size(video, std::string(), width, height)) {
+            ok = false;
+            continue;
+        }
+        ExtractOptions extract;
+        extract.output_format = "yuv420p";
+        const int slot_size = static_cast<int>(max_published_frame_size(extract, width, height));
+
+        for (int slots : {4, 32}) {
+            auto publisher = std::make_unique<SharedFramePublisher>(shared_ring_name("restore_bench", camera),
+                                                                    slots, slot_size);
+            if (!publisher->open()) {
+                ok = false;
+                break;
+            }
+            const std::string name = publisher->name();
+            std::mutex mutex;
+            std::map<int64_t, uint64_t> checksums;  // 发布前记录，消费端按时间戳核对
+            uint64_t received = 0;
+            uint64_t mismatched = 0;
+            uint64_t misaligned = 0;
+            uint64_t dropped = 0;
+            std::thread consumer([&] {
+                SharedFrameSubscriber subscriber;
+                if (!subscriber.open(name)) {
+                    std::cerr << "无法打开共享内存: " << name << std::endl;
+                    mismatched++;
+                    return;
+                }
+                // read 只在读完后顺序锁仍然有效时返回 true，此时 checksum 和 timestamp 属于同一帧
+                uint64_t checksum = 0;
+                int64_t timestamp = 0;
+                auto check = [&](const uint8_t* data, size_t size, int64_t ts) {
+                    if (reinterpret_cast<uintptr_t>(data) % 64 != 0) {
+                        misaligned++;
+                    }
+                    checksum = fnv1a(data, size);
+                    timestamp = ts;
+                };
+                while (true) {
+                    if (subscriber.read(check)) {
+                        received++;
+                        std::lock_guard<std::mutex> lock(mutex);
+                        auto it = checksums.find(timestamp);
+                        if (it == checksums.end() || it->second != checksum) {
+                            mismatched++;
+                        }
+                        continue;
+                    }
+                    if (subscriber.finished()) {
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+                dropped = subscriber.dropped();
+            });
+
+            FrameReader reader(video, txt);
+            FrameConverter converter;
+            RawFrameEncoder encoder(AV_PIX_FMT_YUV420P);
+            uint64_t bytes = 0;
+            BenchTimer timer;
+            AVFrame* frame = nullptr;
+            int64_t timestamp = 0;
+            while (reader.next(frame, timestamp)) {
+                if (frame->format != AV_PIX_FMT_YUV420P) {
+                    AVFrame* converted = converter.convert(frame);
+                    av_frame_free(&frame);
+                    frame = converted;
+                }
+                AVPacket* pkt = frame ? encoder.encode(frame) : nullptr;
+                av_frame_free(&frame);
+                if (!pkt) {
+                    continue;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    checksums[timestamp] = fnv1a(pkt->data, static_cast<size_t>(pkt->size));
+                }
+                if (publisher->publish(pkt->data, static_cast<size_t>(pkt->size), timestamp)) {
+                    bytes += pkt->size;
+                }
+            }
+            publisher.reset();  // 标记发布结束，消费端读完剩余的帧后退出
+            consumer.join();
+
+            BenchResult result{"shm", camera + " slots=" + std::to_string(slots) + " dropped=" +
+                                      std::to_string(dropped)};
+            timer.stop(result);
+            result.frames = received;
+            result.bytes = bytes;
+            results.push_back(result);
+            if (received == 0 || mismatched > 0 || misaligned > 0) {
+                std::cerr << "共享内存读取校验失败: " << name << " (读到 " << received << " 帧, 不一致 "
+                          << mismatched << " 帧, 未对齐 " << misaligned << " 帧)" << std::endl;
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+std::vector<int> parse_int_list(const std::string& text) {
+    std::vector<int> values;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        if (!item.empty()) {
+            values.push_back(std::atoi(item.c_str()));
+        }
+    }
+    return values;
+}
+
+std::vector<std::string> parse_string_list(const std::string& text) {
+    std::vector<std::string> values;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        if (!item.empty()) {
+            values.push_back(item);
+        }
+    }
+    return values;
+}
+
+void print_results(const std::vector<BenchResult>& results) {
+    std::printf("\n%-8s %-48s %8s %10s %10s %10s %8s\n",
+                "stage", "config", "frames", "fps", "wall(s)", "cpu(s)", "MB");
+    for (const auto& r : results) {
+        std::printf("%-8s %-48s %8llu %10.1f %10.3f %10.3f %8.1f\n",
+                    r.name.c_str(), r.config.c_str(), static_cast<unsigned long long>(r.frames),
+                    r.fps(), r.wall_seconds, r.cpu_seconds, r.bytes / 1048576.0);
+    }
+}
+
+void write_results_json(const std::string& path, const std::vector<BenchResult>& results) {
+    std::ofstream out(path);
+    out << "{\"results\":[";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        out << (i ? "," : "") << "{\"stage\":\"" << json_escape(r.name) << "\""
+            << ",\"config\":\"" << json_escape(r.config) << "\""
+            << ",\"frames\":" << r.frames
+            << ",\"fps\":" << r.fps()
+            << ",\"wall_seconds\":" << r.wall_seconds
+            << ",\"cpu_seconds\":" << r.cpu_seconds
+            << ",\"bytes\":" << r.bytes << "}";
+    }
+    out << "]}\n";
+    if (!out) {
+        std::cerr << "无法写入基准测试结果: " << path << std::endl;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    // 解析命令行参数
+    // --video PATH: 输入视频，可重复；默认使用 video/ 下的四路环视视频
+    // --synthetic WxH: 单阶段测试使用合成帧而不是解码视频
+    // --frames N: 单阶段测试使用的帧数
+    // --threads 1,2,4: 要测试的线程数
+    // --quality 50,75,95: 要测试的 JPEG 质量 (1-100)
+    // --jpeg-backend ffmpeg|turbojpeg|auto: 编码测试和端到端测试使用的 JPEG 编码后端
+    // --output-formats jpeg,nv12,...: 端到端测试的输出格式
+    // --stages decode,convert,encode,compare,write,e2e,shm: 要运行的测试，compare 检查 ffmpeg 与 turbojpeg
+    //     两个 JPEG 后端对同一帧的输出是否一致(需要以 RESTORE_WITH_TURBOJPEG 编译)，不一致时退出码为 1；
+    //     shm 发布到共享内存并由消费端读回校验，校验失败时退出码同样为 1
+    // --work-dir DIR: 写入测试和端到端测试的输出目录
+    // --json PATH: 将结果以 JSON 写入 PATH
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--video" && i + 1 < argc) {
+            options.videos.push_back(argv[++i]);
+        } else if (arg == "--synthetic" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%dx%d", &options.synthetic_width, &options.synthetic_height) != 2) {
+                std::cerr << "无效的尺寸: " << argv[i] << " (格式 WxH)" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--frames" && i + 1 < argc) {
+            options.frames = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = parse_int_list(argv[++i]);
+        } else if (arg == "--quality" && i + 1 < argc) {
+            options.qualities = parse_int_list(argv[++i]);
+        } else if (arg == "--jpeg-backend" && i + 1 < argc) {
+            options.jpeg_backend = argv[++i];
+            if (!jpeg_backend_available(options.jpeg_backend)) {
+                std::cerr << "JPEG 编码后端不可用: " << options.jpeg_backend << std::endl;
+                return 1;
+            }
+        } else if (arg == "--output-formats" && i + 1 < argc) {
+            options.output_formats = parse_string_list(argv[++i]);
+            for (const auto& format : options.output_formats) {
+                const OutputFormatInfo* info = find_output_format(format);
+                if (!info || !output_format_available(*info)) {
+                    std::cerr << "输出格式不可用: " << format << std::endl;
+                    return 1;
+                }
+            }
+        } else if (arg == "--stages" && i + 1 < argc) {
+            options.stages = parse_string_list(argv[++i]);
+        } else if (arg == "--work-dir" && i + 1 < argc) {
+            options.work_dir = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            options.json_path = argv[++i];
+        } else {
+            std::cerr << "未知参数: " << arg << std::endl;
+            std::cerr << "用法: " << argv[0]
+                      << " [--video PATH]... [--synthetic WxH] [--frames N] [--threads 1,2,4]"
+                      << " [--quality 50,75,95] [--jpeg-backend NAME] [--output-formats jpeg,nv12,...] [--stages decode,convert,encode,compare,write,e2e,shm]"
+                      << " [--work-dir DIR] [--json PATH]" << std::endl;
+            return 1;
+        }
+    }
+    if (options.threads.empty()) options.threads = {1};
+    if (options.qualities.empty()) options.qualities = {100};
+
+    if (options.videos.empty()) {
+        for (const char* camera : {"front", "rear", "left", "right"}) {
+            std::string path = std::string("video/ofilm_around_") + camera + "_190_3M.mp4";
+            if (fs::exists(path)) {
+                options.videos.push_back(path);
+            }
+        }
+    }
+    if (options.videos.empty() && options.synthetic_width <= 0) {
+        std::cerr << "没有可用的输入视频，请使用 --video 或 --synthetic" << std::endl;
+        return 1;
+    }
+    av_log_set_level(AV_LOG_ERROR);
+
+    std::vector<BenchResult> results;
+    auto enabled = [&](const char* stage) {
+        return std::find(options.stages.begin(), options.stages.end(), stage) != options.stages.end();
+    };
+    if (enabled("decode")) bench_decode(options, results);
+    if (enabled("convert")) bench_convert(options, results);
+    if (enabled("encode")) bench_encode(options, results);
+    bool backends_match = true;
+#ifdef RESTORE_WITH_TURBOJPEG
+    if (enabled("compare")) backends_match = compare_jpeg_backends(options, results);
+#endif
+    if (enabled("write")) bench_write(options, results);
+    if (enabled("e2e")) bench_end_to_end(options, results);
+    bool shared_memory_ok = true;
+    if (enabled("shm")) shared_memory_ok = bench_shared_memory(options, results);
+
+    print_results(results);
+    if (!options.json_path.empty()) {
+        write_results_json(options.json_path, results);
+    }
+    return backends_match && shared_memory_ok ? 0 : 1;
+}
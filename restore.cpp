@@ -1,5 +1,14 @@
 #ifdef _WIN32
+#define NOMINMAX  // 避免 windows.h 的 min/max 宏与 std::min/std::max 冲突
 #include <windows.h>
+#include <io.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 #include <iostream>
 #include <fstream>
@@ -7,6 +16,35 @@
 #include <string>
 #include <filesystem>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <climits>
+#include <charconv>
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#ifdef RESTORE_WITH_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+#ifdef RESTORE_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef RESTORE_WITH_ZSTD
+#include <zstd.h>
+#endif
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -14,418 +52,6068 @@ extern "C" {
 #include <libavutil/imgutils.h>
 #include <libswscale/swscale.h>
 #include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/hwcontext.h>
 }
 
 namespace fs = std::filesystem;
 
-// 解码视频帧并保存为 JPEG 图像
-bool decode_and_save_frame(AVFrame* frame, AVCodecContext* codec_ctx, 
-                          const std::string& output_path, 
-                          int quality = 100) {
-    // 查找 JPEG 编码器
-    const AVCodec* jpeg_codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
-    if (!jpeg_codec) {
-        std::cerr << "JPEG 编码器未找到" << std::endl;
+// MJPEG 编码器可直接接受的像素格式(8 位平面 4:2:0/4:2:2/4:4:4)
+bool is_jpeg_native_format(int format) {
+    switch (format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+        return true;
+    default:
         return false;
     }
+}
 
-    // 创建 JPEG 编码器上下文
-    AVCodecContext* jpeg_ctx = avcodec_alloc_context3(jpeg_codec);
-    if (!jpeg_ctx) {
-        std::cerr << "无法分配 JPEG 编码器上下文" << std::endl;
-        return false;
-    }
+// 帧数据是否为全范围(0-255)
+bool is_full_range(const AVFrame* frame) {
+    return frame->color_range == AVCOL_RANGE_JPEG ||
+           frame->format == AV_PIX_FMT_YUVJ420P ||
+           frame->format == AV_PIX_FMT_YUVJ422P ||
+           frame->format == AV_PIX_FMT_YUVJ444P;
+}
 
-    // 设置编码器参数
-    jpeg_ctx->pix_fmt = AV_PIX_FMT_YUVJ420P;  // JPEG 兼容格式
-    jpeg_ctx->time_base = {1, 30};            // 帧率
-    jpeg_ctx->width = frame->width;
-    jpeg_ctx->height = frame->height;
-    
-    // 设置 JPEG 质量 (1-100, 100 为最高质量)
-    av_opt_set_int(jpeg_ctx, "qscale", quality, 0);
+// JPEG 编码器可直接编码的帧: 原生格式的全范围数据
+// 有限范围的 YUV 原样写入 JPEG 后，按 JFIF 全范围解释的读取方(PIL、OpenCV、浏览器)会显示成发灰的画面，
+// 因此有限范围的帧必须先经过 FrameConverter 扩展为全范围
+bool is_jpeg_native_frame(const AVFrame* frame) {
+    return is_jpeg_native_format(frame->format) && is_full_range(frame);
+}
 
-    // 打开编码器
-    if (avcodec_open2(jpeg_ctx, jpeg_codec, nullptr) < 0) {
-        std::cerr << "无法打开 JPEG 编码器" << std::endl;
-        avcodec_free_context(&jpeg_ctx);
-        return false;
-    }
+// 帧编码器接口
+// 每个编码线程持有自己的实例；encode 返回的数据包归编码器所有，在下一次 encode 调用前有效，
+// 调用方可以用 av_packet_move_ref 取走其中的数据
+class FrameEncoder {
+public:
+    virtual ~FrameEncoder() = default;
+    virtual AVPacket* encode(const AVFrame* frame) = 0;
+    virtual const char* name() const = 0;
+};
 
-    // 创建数据包
-    AVPacket* pkt = av_packet_alloc();
-    if (!pkt) {
-        std::cerr << "无法分配数据包" << std::endl;
-        avcodec_free_context(&jpeg_ctx);
-        return false;
-    }
+// 将 1-100 的 JPEG 质量(100 最好)映射为 MJPEG 编码器的量化参数 qscale (1-31，1 最好)
+static int jpeg_quality_to_qscale(int quality) {
+    quality = std::min(100, std::max(1, quality));
+    return 1 + ((100 - quality) * 30 + 49) / 99;
+}
 
-    // 发送帧到编码器
-    int ret = avcodec_send_frame(jpeg_ctx, frame);
-    if (ret < 0) {
-        std::cerr << "发送帧到编码器失败: " << av_err2str(ret) << std::endl;
-        av_packet_free(&pkt);
-        avcodec_free_context(&jpeg_ctx);
-        return false;
-    }
+// 每路视频流复用的 JPEG 编码器 (FFmpeg MJPEG)
+// 编码器的像素格式与输入帧一致，全范围的 4:2:0 等原生格式无需转换即可编码(见 is_jpeg_native_frame)
+// 编码器上下文和输出数据包只创建一次，仅在帧的宽、高或像素格式变化时重建
+class JpegEncoder : public FrameEncoder {
+public:
+    // quality: 1-100，100 为最高质量
+    explicit JpegEncoder(int quality = 90, int thread_count = 1)
+        : quality_(quality), thread_count_(thread_count) {}
+    ~JpegEncoder() override { close(); }
 
-    // 接收编码后的数据包
-    ret = avcodec_receive_packet(jpeg_ctx, pkt);
-    if (ret < 0) {
-        std::cerr << "接收数据包失败: " << av_err2str(ret) << std::endl;
-        av_packet_free(&pkt);
-        avcodec_free_context(&jpeg_ctx);
-        return false;
-    }
+    JpegEncoder(const JpegEncoder&) = delete;
+    JpegEncoder& operator=(const JpegEncoder&) = delete;
 
-    // 将编码后的数据写入文件
-    FILE* file = fopen(output_path.c_str(), "wb");
-    if (!file) {
-        std::cerr << "无法打开输出文件: " << output_path << std::endl;
-        av_packet_free(&pkt);
-        avcodec_free_context(&jpeg_ctx);
-        return false;
-    }
+    const char* name() const override { return "ffmpeg"; }
 
-    size_t written = fwrite(pkt->data, 1, pkt->size, file);
-    if (written != pkt->size) {
-        std::cerr << "写入文件不完整: 预期 " << pkt->size << " 字节，实际写入 " << written << " 字节" << std::endl;
-    }
-    fclose(file);
+    // 编码一帧，返回的数据包归编码器所有，在下一次 encode 调用前有效
+    AVPacket* encode(const AVFrame* frame) override {
+        if (!is_jpeg_native_frame(frame)) {
+            std::cerr << "JPEG 编码器不支持的像素格式或有限范围数据: "
+                      << av_get_pix_fmt_name(static_cast<AVPixelFormat>(frame->format)) << std::endl;
+            return nullptr;
+        }
+        if (!ensure_open(frame->width, frame->height, static_cast<AVPixelFormat>(frame->format))) {
+            return nullptr;
+        }
 
-    // 清理资源
-    av_packet_free(&pkt);
-    avcodec_free_context(&jpeg_ctx);
+        av_packet_unref(pkt_);
 
-    return true;
-}
+        // 发送帧到编码器
+        int ret = avcodec_send_frame(jpeg_ctx_, frame);
+        if (ret < 0) {
+            std::cerr << "发送帧到编码器失败: " << av_err2str(ret) << std::endl;
+            return nullptr;
+        }
 
-// 主解码函数
-bool decode_video_to_images(const std::string& video_path,
-                            const std::string& txt_path,
-                            const std::string& output_dir) {
-    // 确保输出目录存在
-    if (!fs::exists(output_dir) && !fs::create_directories(output_dir)) {
-        std::cerr << "无法创建输出目录: " << output_dir << std::endl;
-        return false;
+        // 接收编码后的数据包
+        ret = avcodec_receive_packet(jpeg_ctx_, pkt_);
+        if (ret < 0) {
+            std::cerr << "接收数据包失败: " << av_err2str(ret) << std::endl;
+            return nullptr;
+        }
+
+        return pkt_;
     }
 
-    // 检查索引文件是否存在
-    if (!fs::exists(txt_path)) {
-        std::cerr << "索引文件不存在: " << txt_path << std::endl;
-        return false;
+private:
+    bool ensure_open(int width, int height, AVPixelFormat src_fmt) {
+        if (jpeg_ctx_ && width == width_ && height == height_ && src_fmt == src_fmt_) {
+            return true;
+        }
+        close();
+
+        // 查找 JPEG 编码器
+        const AVCodec* jpeg_codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+        if (!jpeg_codec) {
+            std::cerr << "JPEG 编码器未找到" << std::endl;
+            return false;
+        }
+
+        // 创建 JPEG 编码器上下文
+        jpeg_ctx_ = avcodec_alloc_context3(jpeg_codec);
+        if (!jpeg_ctx_) {
+            std::cerr << "无法分配 JPEG 编码器上下文" << std::endl;
+            return false;
+        }
+
+        // 设置编码器参数
+        jpeg_ctx_->pix_fmt = src_fmt;
+        jpeg_ctx_->color_range = AVCOL_RANGE_JPEG;
+        jpeg_ctx_->time_base = {1, 30};            // 帧率
+        jpeg_ctx_->width = width;
+        jpeg_ctx_->height = height;
+
+        // MJPEG 编码器支持按切片多线程编码
+        jpeg_ctx_->thread_count = thread_count_;
+        jpeg_ctx_->thread_type = FF_THREAD_SLICE;
+
+        // 固定量化参数编码: MJPEG 没有 "qscale" 选项，质量由 global_quality 和 qmin/qmax 控制
+        int qscale = jpeg_quality_to_qscale(quality_);
+        jpeg_ctx_->flags |= AV_CODEC_FLAG_QSCALE;
+        jpeg_ctx_->global_quality = FF_QP2LAMBDA * qscale;
+        jpeg_ctx_->qmin = qscale;
+        jpeg_ctx_->qmax = qscale;
+
+        // 打开编码器
+        if (avcodec_open2(jpeg_ctx_, jpeg_codec, nullptr) < 0) {
+            std::cerr << "无法打开 JPEG 编码器" << std::endl;
+            close();
+            return false;
+        }
+
+        // 创建可复用的数据包
+        pkt_ = av_packet_alloc();
+        if (!pkt_) {
+            std::cerr << "无法分配数据包" << std::endl;
+            close();
+            return false;
+        }
+
+        width_ = width;
+        height_ = height;
+        src_fmt_ = src_fmt;
+        return true;
     }
 
-    // 读取帧索引映射
-    std::ifstream index_file(txt_path);
-    if (!index_file.is_open()) {
-        std::cerr << "无法打开索引文件: " << txt_path << std::endl;
-        return false;
+    void close() {
+        av_packet_free(&pkt_);
+        avcodec_free_context(&jpeg_ctx_);
+        width_ = 0;
+        height_ = 0;
+        src_fmt_ = AV_PIX_FMT_NONE;
     }
 
-    std::vector<std::string> frame_indices;
-    std::string line;
-    while (std::getline(index_file, line)) {
-        if (!line.empty()) {
-            frame_indices.push_back(line);
+    int quality_;
+    int thread_count_;
+    AVCodecContext* jpeg_ctx_ = nullptr;
+    AVPacket* pkt_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    AVPixelFormat src_fmt_ = AV_PIX_FMT_NONE;
+};
+
+#ifdef RESTORE_WITH_TURBOJPEG
+// libjpeg-turbo 编码器: 直接从解码帧的 YUV 平面(含行跨度)编码，不做中间拷贝
+// 与 JpegEncoder 一样只接受全范围数据，有限范围的帧由转换阶段先扩展(见 is_jpeg_native_frame)
+// 输出缓冲区来自按最大 JPEG 尺寸分配的缓冲池，编码结果以引用方式交给写入阶段
+class TurboJpegEncoder : public FrameEncoder {
+public:
+    explicit TurboJpegEncoder(int quality = 90) : quality_(std::min(100, std::max(1, quality))) {}
+
+    ~TurboJpegEncoder() override {
+        av_packet_free(&pkt_);
+        av_buffer_pool_uninit(&pool_);
+        if (handle_) {
+            tjDestroy(handle_);
         }
     }
-    index_file.close();
 
-    // 注册所有编解码器
-    avformat_network_init();
-    
-    // 检查视频文件是否存在
-    if (!fs::exists(video_path)) {
-        std::cerr << "视频文件不存在: " << video_path << std::endl;
-        return false;
+    TurboJpegEncoder(const TurboJpegEncoder&) = delete;
+    TurboJpegEncoder& operator=(const TurboJpegEncoder&) = delete;
+
+    const char* name() const override { return "turbojpeg"; }
+
+    AVPacket* encode(const AVFrame* frame) override {
+        int subsamp = subsampling_of(frame->format);
+        if (subsamp < 0 || !is_full_range(frame)) {
+            std::cerr << "TurboJPEG 不支持的像素格式或有限范围数据: "
+                      << av_get_pix_fmt_name(static_cast<AVPixelFormat>(frame->format)) << std::endl;
+            return nullptr;
+        }
+        if (!handle_ && !(handle_ = tjInitCompress())) {
+            std::cerr << "无法初始化 TurboJPEG: " << tjGetErrorStr() << std::endl;
+            return nullptr;
+        }
+        if (!pkt_ && !(pkt_ = av_packet_alloc())) {
+            std::cerr << "无法分配数据包" << std::endl;
+            return nullptr;
+        }
+
+        unsigned long max_size = tjBufSize(frame->width, frame->height, subsamp);
+        if (!pool_ || max_size != pool_buffer_size_) {
+            av_buffer_pool_uninit(&pool_);
+            pool_ = av_buffer_pool_init(max_size, nullptr);
+            pool_buffer_size_ = max_size;
+            if (!pool_) {
+                std::cerr << "无法创建 JPEG 输出缓冲池" << std::endl;
+                return nullptr;
+            }
+        }
+
+        av_packet_unref(pkt_);
+        AVBufferRef* buf = av_buffer_pool_get(pool_);
+        if (!buf) {
+            std::cerr << "无法分配 JPEG 输出缓冲区" << std::endl;
+            return nullptr;
+        }
+
+        const unsigned char* planes[3] = {frame->data[0], frame->data[1], frame->data[2]};
+        int strides[3] = {frame->linesize[0], frame->linesize[1], frame->linesize[2]};
+        unsigned char* out = buf->data;
+        unsigned long size = max_size;
+        if (tjCompressFromYUVPlanes(handle_, planes, frame->width, strides, frame->height, subsamp,
+                                    &out, &size, quality_, TJFLAG_NOREALLOC | TJFLAG_FASTDCT) != 0) {
+            std::cerr << "TurboJPEG 编码失败: " << tjGetErrorStr2(handle_) << std::endl;
+            av_buffer_unref(&buf);
+            return nullptr;
+        }
+
+        pkt_->buf = buf;
+        pkt_->data = buf->data;
+        pkt_->size = static_cast<int>(size);
+        return pkt_;
     }
 
-    // 打开视频文件
-    AVFormatContext* format_ctx = nullptr;
-    int ret = avformat_open_input(&format_ctx, video_path.c_str(), nullptr, nullptr);
-    if (ret != 0) {
-        std::cerr << "无法打开视频文件: " << video_path << std::endl;
-        std::cerr << "错误代码: " << av_err2str(ret) << std::endl;
-        return false;
+private:
+    static int subsampling_of(int format) {
+        switch (format) {
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUVJ420P:
+            return TJSAMP_420;
+        case AV_PIX_FMT_YUV422P:
+        case AV_PIX_FMT_YUVJ422P:
+            return TJSAMP_422;
+        case AV_PIX_FMT_YUV444P:
+        case AV_PIX_FMT_YUVJ444P:
+            return TJSAMP_444;
+        default:
+            return -1;
+        }
     }
 
-    // 获取流信息
-    if (avformat_find_stream_info(format_ctx, nullptr) < 0) {
-        std::cerr << "无法获取流信息" << std::endl;
-        avformat_close_input(&format_ctx);
-        return false;
+    const int quality_;
+    tjhandle handle_ = nullptr;
+    AVPacket* pkt_ = nullptr;
+    AVBufferPool* pool_ = nullptr;
+    unsigned long pool_buffer_size_ = 0;
+};
+#endif  // RESTORE_WITH_TURBOJPEG
+
+// GPU JPEG 编码器(见 GpuJpegEncoder)，定义在硬件帧取回函数之后
+std::unique_ptr<FrameEncoder> create_gpu_jpeg_encoder(int quality, int thread_count);
+
+// JPEG 编码后端是否可用: ffmpeg 总是可用，turbojpeg 需要以 RESTORE_WITH_TURBOJPEG 编译
+// gpu 在设备没有 JPEG 编码器时自动退回 CPU 编码，因此也总是可用
+bool jpeg_backend_available(const std::string& backend) {
+    if (backend == "ffmpeg" || backend == "auto" || backend == "gpu") {
+        return true;
     }
+#ifdef RESTORE_WITH_TURBOJPEG
+    if (backend == "turbojpeg") {
+        return true;
+    }
+#endif
+    return false;
+}
 
-    // 查找视频流
-    int video_stream_index = -1;
-    AVCodecParameters* codec_params = nullptr;
-    const AVCodec* codec = nullptr;
-    
-    for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
-        if (format_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-            video_stream_index = i;
-            codec_params = format_ctx->streams[i]->codecpar;
-            codec = avcodec_find_decoder(codec_params->codec_id);
-            break;
-        }
+// 按名称创建 JPEG 编码器，auto 优先选择 turbojpeg
+std::unique_ptr<FrameEncoder> create_jpeg_encoder(const std::string& backend, int quality,
+                                                  int thread_count) {
+    if (backend == "gpu") {
+        return create_gpu_jpeg_encoder(quality, thread_count);
     }
-    
-    if (video_stream_index == -1 || !codec) {
-        std::cerr << "未找到视频流或解码器" << std::endl;
-        avformat_close_input(&format_ctx);
-        return false;
+#ifdef RESTORE_WITH_TURBOJPEG
+    if (backend == "turbojpeg" || backend == "auto") {
+        return std::make_unique<TurboJpegEncoder>(quality);
     }
+#else
+    (void)backend;
+#endif
+    return std::make_unique<JpegEncoder>(quality, thread_count);
+}
 
-    // 创建解码器上下文
-    AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
-    if (!codec_ctx) {
-        std::cerr << "无法分配解码器上下文" << std::endl;
-        avformat_close_input(&format_ctx);
-        return false;
+// 输出格式: JPEG 之外还支持原始像素数据和无损图像，省去下游训练/拼接任务再次解码 JPEG 的开销
+// 原始格式不带文件头，按行紧密排列(无行填充)，YUV 为全范围数据，宽高与视频流一致
+enum class OutputFormat {
+    kJpeg,     // JPEG (见 JpegEncoder / TurboJpegEncoder)
+    kYuv420p,  // 平面 I420: Y 平面之后依次为 U、V 平面
+    kNv12,     // Y 平面之后为交错的 UV 平面
+    kRgb24,    // 交错 RGB
+    kGbrp,     // 平面 RGB (FFmpeg 约定的 G、B、R 平面顺序)
+    kPng,      // 无损 PNG (RGB24)
+    kWebp,     // 无损 WebP (需要 FFmpeg 编译了 libwebp)
+};
+
+struct OutputFormatInfo {
+    OutputFormat format;
+    const char* name;
+    const char* extension;
+    AVPixelFormat pixel_format;  // 编码器要求的像素格式，JPEG 为转换目标(另外接受其他原生格式)
+};
+
+static const OutputFormatInfo kOutputFormats[] = {
+    {OutputFormat::kJpeg, "jpeg", ".jpg", AV_PIX_FMT_YUV420P},
+    {OutputFormat::kYuv420p, "yuv420p", ".yuv", AV_PIX_FMT_YUV420P},
+    {OutputFormat::kNv12, "nv12", ".nv12", AV_PIX_FMT_NV12},
+    {OutputFormat::kRgb24, "rgb24", ".rgb", AV_PIX_FMT_RGB24},
+    {OutputFormat::kGbrp, "gbrp", ".gbrp", AV_PIX_FMT_GBRP},
+    {OutputFormat::kPng, "png", ".png", AV_PIX_FMT_RGB24},
+    {OutputFormat::kWebp, "webp", ".webp", AV_PIX_FMT_RGB32},
+};
+
+// 按名称查找输出格式，未知名称返回 nullptr
+const OutputFormatInfo* find_output_format(const std::string& name) {
+    for (const auto& info : kOutputFormats) {
+        if (name == info.name) {
+            return &info;
+        }
     }
+    return nullptr;
+}
 
-    // 复制编解码器参数到上下文
-    if (avcodec_parameters_to_context(codec_ctx, codec_params) < 0) {
-        std::cerr << "无法复制编解码器参数" << std::endl;
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&format_ctx);
-        return false;
+const OutputFormatInfo& output_format_info(OutputFormat format) {
+    for (const auto& info : kOutputFormats) {
+        if (info.format == format) {
+            return info;
+        }
     }
+    return kOutputFormats[0];
+}
 
-    // 强制使用软件解码
-    codec_ctx->hw_device_ctx = nullptr;
-    codec_ctx->get_format = nullptr; // 禁用硬件加速回调
+// 是否为不经过图像编码器的原始像素格式
+bool is_raw_output_format(OutputFormat format) {
+    return format == OutputFormat::kYuv420p || format == OutputFormat::kNv12 ||
+           format == OutputFormat::kRgb24 || format == OutputFormat::kGbrp;
+}
 
-    // 打开解码器
-    if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
-        std::cerr << "无法打开解码器" << std::endl;
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&format_ctx);
-        return false;
+// 该输出格式的编码器能否直接接受这一帧，不能时转换阶段负责转换(JPEG 还要求全范围数据)
+bool output_format_accepts(const OutputFormatInfo& info, const AVFrame* frame) {
+    if (info.format == OutputFormat::kJpeg) {
+        return is_jpeg_native_frame(frame);
     }
+    return frame->format == info.pixel_format;
+}
 
-    // 创建帧和包
-    AVFrame* frame = av_frame_alloc();
-    AVPacket* packet = av_packet_alloc();
-    if (!frame || !packet) {
-        std::cerr << "无法分配帧或包" << std::endl;
-        av_frame_free(&frame);
-        av_packet_free(&packet);
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&format_ctx);
-        return false;
+// 输出格式在当前 FFmpeg 构建中是否可用
+bool output_format_available(const OutputFormatInfo& info) {
+    switch (info.format) {
+    case OutputFormat::kPng:
+        return avcodec_find_encoder(AV_CODEC_ID_PNG) != nullptr;
+    case OutputFormat::kWebp:
+        return avcodec_find_encoder_by_name("libwebp") != nullptr;
+    default:
+        return true;
     }
+}
 
-    // 创建图像转换上下文 (如果需要)
-    SwsContext* sws_ctx = nullptr;
-    if (codec_ctx->pix_fmt != AV_PIX_FMT_YUV420P && 
-        codec_ctx->pix_fmt != AV_PIX_FMT_YUVJ420P) {
-        sws_ctx = sws_getContext(
-            codec_ctx->width, codec_ctx->height, codec_ctx->pix_fmt,
-            codec_ctx->width, codec_ctx->height, AV_PIX_FMT_YUV420P,
-            SWS_BILINEAR, nullptr, nullptr, nullptr
-        );
-        
-        if (!sws_ctx) {
-            std::cerr << "无法创建图像转换上下文" << std::endl;
-            av_frame_free(&frame);
-            av_packet_free(&packet);
-            avcodec_free_context(&codec_ctx);
-            avformat_close_input(&format_ctx);
-            return false;
-        }
+// 原始像素数据编码器: 把帧的各平面去掉行填充后紧密排列到一个数据包中，不经过任何图像编码
+// 输出缓冲区来自按帧大小分配的缓冲池，写入阶段释放数据包后缓冲区回到池中
+class RawFrameEncoder : public FrameEncoder {
+public:
+    explicit RawFrameEncoder(AVPixelFormat format) : format_(format) {}
+
+    ~RawFrameEncoder() override {
+        av_packet_free(&pkt_);
+        av_buffer_pool_uninit(&pool_);
     }
 
-    // 解码循环
-    int frame_count = 0;
-    int decoded_frames = 0;
-    bool success = true;
+    RawFrameEncoder(const RawFrameEncoder&) = delete;
+    RawFrameEncoder& operator=(const RawFrameEncoder&) = delete;
 
-    while (true) {
-        ret = av_read_frame(format_ctx, packet);
-        if (ret < 0) {
-            break;
+    const char* name() const override { return "raw"; }
+
+    AVPacket* encode(const AVFrame* frame) override {
+        if (frame->format != format_) {
+            std::cerr << "原始输出的像素格式不匹配: "
+                      << av_get_pix_fmt_name(static_cast<AVPixelFormat>(frame->format)) << std::endl;
+            return nullptr;
+        }
+        if (!pkt_ && !(pkt_ = av_packet_alloc())) {
+            std::cerr << "无法分配数据包" << std::endl;
+            return nullptr;
         }
 
-        if (packet->stream_index == video_stream_index) {
-            // 检查解码器上下文和数据包是否有效
-            if (!codec_ctx || !packet) {
-                std::cerr << "无效的解码器上下文或数据包" << std::endl;
-                av_packet_unref(packet);
-                continue;
-            }
-            
-            // 发送数据包到解码器
-            ret = avcodec_send_packet(codec_ctx, packet);
-            if (ret < 0) {
-                av_packet_unref(packet);
-                continue;
+        int size = av_image_get_buffer_size(format_, frame->width, frame->height, 1);
+        if (size <= 0) {
+            std::cerr << "无法计算原始帧大小" << std::endl;
+            return nullptr;
+        }
+        if (!pool_ || size != pool_buffer_size_) {
+            av_buffer_pool_uninit(&pool_);
+            pool_ = av_buffer_pool_init(size, nullptr);
+            pool_buffer_size_ = size;
+            if (!pool_) {
+                std::cerr << "无法创建原始帧缓冲池" << std::endl;
+                return nullptr;
             }
+        }
 
-            // 接收解码后的帧
-            while (true) {
-                ret = avcodec_receive_frame(codec_ctx, frame);
-                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                    break;
-                } else if (ret < 0) {
-                    std::cerr << "接收帧失败: " << av_err2str(ret) << std::endl;
-                    success = false;
-                    break;
-                }
+        av_packet_unref(pkt_);
+        AVBufferRef* buf = av_buffer_pool_get(pool_);
+        if (!buf) {
+            std::cerr << "无法分配原始帧缓冲区" << std::endl;
+            return nullptr;
+        }
+        if (av_image_copy_to_buffer(buf->data, size, frame->data, frame->linesize, format_,
+                                    frame->width, frame->height, 1) < 0) {
+            std::cerr << "复制原始帧数据失败" << std::endl;
+            av_buffer_unref(&buf);
+            return nullptr;
+        }
 
-                // 检查是否超出索引范围
-                if (frame_count >= static_cast<int>(frame_indices.size())) {
-                    av_frame_unref(frame);
-                    break;
-                }
+        pkt_->buf = buf;
+        pkt_->data = buf->data;
+        pkt_->size = size;
+        return pkt_;
+    }
 
-                // 准备输出文件路径
-                std::string output_path = output_dir + "/" + frame_indices[frame_count] + ".jpg";
+private:
+    const AVPixelFormat format_;
+    AVPacket* pkt_ = nullptr;
+    AVBufferPool* pool_ = nullptr;
+    int pool_buffer_size_ = 0;
+};
 
-                AVFrame* output_frame = frame;
-                AVFrame* converted_frame = nullptr;
+// 无损图像编码器 (FFmpeg PNG / libwebp)
+// 与 JpegEncoder 相同，编码器上下文只在帧尺寸变化时重建
+class LosslessImageEncoder : public FrameEncoder {
+public:
+    explicit LosslessImageEncoder(OutputFormat format) : format_(format) {}
+    ~LosslessImageEncoder() override { close(); }
 
-                // 如果像素格式不兼容，进行转换
-                if (sws_ctx) {
-                    converted_frame = av_frame_alloc();
-                    if (!converted_frame) {
-                        std::cerr << "无法分配转换帧" << std::endl;
-                        success = false;
-                        break;
-                    }
+    LosslessImageEncoder(const LosslessImageEncoder&) = delete;
+    LosslessImageEncoder& operator=(const LosslessImageEncoder&) = delete;
 
-                    converted_frame->format = AV_PIX_FMT_YUV420P;
-                    converted_frame->width = frame->width;
-                    converted_frame->height = frame->height;
+    const char* name() const override { return output_format_info(format_).name; }
 
-                    if (av_frame_get_buffer(converted_frame, 0) < 0) {
-                        std::cerr << "无法分配转换帧缓冲区" << std::endl;
-                        av_frame_free(&converted_frame);
-                        success = false;
-                        break;
-                    }
+    AVPacket* encode(const AVFrame* frame) override {
+        if (!ensure_open(frame->width, frame->height, static_cast<AVPixelFormat>(frame->format))) {
+            return nullptr;
+        }
 
-                    // 执行转换
-                    int convert_ret = sws_scale(sws_ctx, 
-                              frame->data, frame->linesize, 0, frame->height,
-                              converted_frame->data, converted_frame->linesize);
-                    if (convert_ret <= 0) {
-                        std::cerr << "图像转换失败" << std::endl;
-                        av_frame_free(&converted_frame);
-                        success = false;
-                        break;
-                    }
+        av_packet_unref(pkt_);
+        int ret = avcodec_send_frame(ctx_, frame);
+        if (ret < 0) {
+            std::cerr << "发送帧到编码器失败: " << av_err2str(ret) << std::endl;
+            return nullptr;
+        }
+        ret = avcodec_receive_packet(ctx_, pkt_);
+        if (ret < 0) {
+            std::cerr << "接收数据包失败: " << av_err2str(ret) << std::endl;
+            return nullptr;
+        }
+        return pkt_;
+    }
 
-                    output_frame = converted_frame;
-                }
+private:
+    bool ensure_open(int width, int height, AVPixelFormat pix_fmt) {
+        if (ctx_ && width == width_ && height == height_ && pix_fmt == pix_fmt_) {
+            return true;
+        }
+        close();
 
-                // 保存帧为JPEG
-                if (!decode_and_save_frame(output_frame, codec_ctx, output_path)) {
-                    std::cerr << "保存帧失败: " << output_path << std::endl;
-                    success = false;
-                } else {
-                    decoded_frames++;
-                }
+        const AVCodec* codec = format_ == OutputFormat::kWebp
+                                   ? avcodec_find_encoder_by_name("libwebp")
+                                   : avcodec_find_encoder(AV_CODEC_ID_PNG);
+        if (!codec) {
+            std::cerr << name() << " 编码器未找到" << std::endl;
+            return false;
+        }
+        ctx_ = avcodec_alloc_context3(codec);
+        if (!ctx_) {
+            std::cerr << "无法分配 " << name() << " 编码器上下文" << std::endl;
+            return false;
+        }
 
-                // 清理转换帧
-                if (converted_frame) {
-                    av_frame_free(&converted_frame);
-                }
-                
-                frame_count++;
-            }
+        ctx_->pix_fmt = pix_fmt;
+        ctx_->time_base = {1, 30};
+        ctx_->width = width;
+        ctx_->height = height;
+        if (format_ == OutputFormat::kWebp) {
+            av_opt_set_int(ctx_->priv_data, "lossless", 1, 0);
+        } else {
+            // 速度优先: zlib 最低压缩级别，PNG 仍然是无损的
+            ctx_->compression_level = 1;
         }
-        
-        av_packet_unref(packet);
-    }
 
-    // 刷新解码器缓冲区
-    avcodec_send_packet(codec_ctx, nullptr);
-    while (avcodec_receive_frame(codec_ctx, frame) >= 0) {
-        // 处理剩余的帧（如果有）
-        if (frame_count < static_cast<int>(frame_indices.size())) {
-            std::string output_path = output_dir + "/" + frame_indices[frame_count] + ".jpg";
-            if (!decode_and_save_frame(frame, codec_ctx, output_path)) {
-                std::cerr << "保存帧失败: " << output_path << std::endl;
-                success = false;
-            } else {
-                decoded_frames++;
-            }
-            frame_count++;
+        if (avcodec_open2(ctx_, codec, nullptr) < 0) {
+            std::cerr << "无法打开 " << name() << " 编码器" << std::endl;
+            close();
+            return false;
+        }
+        pkt_ = av_packet_alloc();
+        if (!pkt_) {
+            std::cerr << "无法分配数据包" << std::endl;
+            close();
+            return false;
         }
-    }
 
-    // 清理资源
-    if (sws_ctx) sws_freeContext(sws_ctx);
-    av_frame_free(&frame);
-    av_packet_free(&packet);
-    avcodec_free_context(&codec_ctx);
-    avformat_close_input(&format_ctx);
-    
-    return success;
-}
+        width_ = width;
+        height_ = height;
+        pix_fmt_ = pix_fmt;
+        return true;
+    }
 
-int main(int argc, char* argv[]) {
-    #ifdef _WIN32
-    // 设置 DLL 搜索路径 - 指向本地 FFmpeg 安装目录
-    const char* dllPath = "D:\\ffmpeg-n7.1.1-56-gc2184b65d2-win64-gpl-shared-7.1\\bin";
-    if (!SetDllDirectoryA(dllPath)) {
-        std::cerr << "Failed to set DLL directory: " << GetLastError() << std::endl;
-        return 1;
+    void close() {
+        av_packet_free(&pkt_);
+        avcodec_free_context(&ctx_);
+        width_ = 0;
+        height_ = 0;
+        pix_fmt_ = AV_PIX_FMT_NONE;
     }
-    #endif
 
-    // 定义摄像头配置
-    const std::vector<std::string> cameras = {
+    const OutputFormat format_;
+    AVCodecContext* ctx_ = nullptr;
+    AVPacket* pkt_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    AVPixelFormat pix_fmt_ = AV_PIX_FMT_NONE;
+};
+
+// 原始输出的通用压缩: lz4 (需要 RESTORE_WITH_LZ4) 或 zstd (需要 RESTORE_WITH_ZSTD)
+// 包装任意原始编码器，压缩结果同样写入缓冲池中的缓冲区
+bool frame_compression_available(const std::string& method) {
+    if (method == "none") {
+        return true;
+    }
+#ifdef RESTORE_WITH_LZ4
+    if (method == "lz4") {
+        return true;
+    }
+#endif
+#ifdef RESTORE_WITH_ZSTD
+    if (method == "zstd") {
+        return true;
+    }
+#endif
+    return false;
+}
+
+// 压缩后的文件扩展名后缀
+const char* frame_compression_extension(const std::string& method) {
+    if (method == "lz4") {
+        return ".lz4";
+    }
+    if (method == "zstd") {
+        return ".zst";
+    }
+    return "";
+}
+
+// size 字节的数据按 method 压缩后的最大字节数，不压缩("none")时即 size
+size_t compressed_size_bound(const std::string& method, int size) {
+#ifdef RESTORE_WITH_LZ4
+    if (method == "lz4") {
+        return static_cast<size_t>(LZ4_compressBound(size));
+    }
+#endif
+#ifdef RESTORE_WITH_ZSTD
+    if (method == "zstd") {
+        return ZSTD_compressBound(static_cast<size_t>(size));
+    }
+#endif
+    (void)method;
+    return static_cast<size_t>(size);
+}
+
+#if defined(RESTORE_WITH_LZ4) || defined(RESTORE_WITH_ZSTD)
+class CompressedFrameEncoder : public FrameEncoder {
+public:
+    CompressedFrameEncoder(std::unique_ptr<FrameEncoder> inner, std::string method, int level)
+        : inner_(std::move(inner)), method_(std::move(method)), level_(level) {}
+
+    ~CompressedFrameEncoder() override {
+        av_packet_free(&pkt_);
+        av_buffer_pool_uninit(&pool_);
+#ifdef RESTORE_WITH_ZSTD
+        ZSTD_freeCCtx(zstd_ctx_);
+#endif
+    }
+
+    CompressedFrameEncoder(const CompressedFrameEncoder&) = delete;
+    CompressedFrameEncoder& operator=(const CompressedFrameEncoder&) = delete;
+
+    const char* name() const override { return method_.c_str(); }
+
+    AVPacket* encode(const AVFrame* frame) override {
+        AVPacket* raw = inner_->encode(frame);
+        if (!raw) {
+            return nullptr;
+        }
+        if (!pkt_ && !(pkt_ = av_packet_alloc())) {
+            std::cerr << "无法分配数据包" << std::endl;
+            return nullptr;
+        }
+
+        size_t bound = compress_bound(raw->size);
+        if (!pool_ || bound != pool_buffer_size_) {
+            av_buffer_pool_uninit(&pool_);
+            pool_ = av_buffer_pool_init(bound, nullptr);
+            pool_buffer_size_ = bound;
+            if (!pool_) {
+                std::cerr << "无法创建压缩缓冲池" << std::endl;
+                return nullptr;
+            }
+        }
+
+        av_packet_unref(pkt_);
+        AVBufferRef* buf = av_buffer_pool_get(pool_);
+        if (!buf) {
+            std::cerr << "无法分配压缩缓冲区" << std::endl;
+            return nullptr;
+        }
+        size_t size = compress(raw->data, raw->size, buf->data, bound);
+        if (size == 0) {
+            std::cerr << method_ << " 压缩失败" << std::endl;
+            av_buffer_unref(&buf);
+            return nullptr;
+        }
+
+        pkt_->buf = buf;
+        pkt_->data = buf->data;
+        pkt_->size = static_cast<int>(size);
+        return pkt_;
+    }
+
+private:
+    size_t compress_bound(int size) const { return compressed_size_bound(method_, size); }
+
+    // 返回压缩后的字节数，失败时返回 0
+    size_t compress(const uint8_t* src, int size, uint8_t* dst, size_t capacity) {
+#ifdef RESTORE_WITH_LZ4
+        if (method_ == "lz4") {
+            // level 为加速因子，1 为默认速度
+            int ret = LZ4_compress_fast(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                                        size, static_cast<int>(capacity), std::max(1, level_));
+            return ret > 0 ? static_cast<size_t>(ret) : 0;
+        }
+#endif
+#ifdef RESTORE_WITH_ZSTD
+        if (method_ == "zstd") {
+            if (!zstd_ctx_ && !(zstd_ctx_ = ZSTD_createCCtx())) {
+                return 0;
+            }
+            size_t ret = ZSTD_compressCCtx(zstd_ctx_, dst, capacity, src, static_cast<size_t>(size), level_);
+            return ZSTD_isError(ret) ? 0 : ret;
+        }
+#endif
+        (void)src;
+        (void)size;
+        (void)dst;
+        (void)capacity;
+        return 0;
+    }
+
+    std::unique_ptr<FrameEncoder> inner_;
+    const std::string method_;
+    const int level_;
+    AVPacket* pkt_ = nullptr;
+    AVBufferPool* pool_ = nullptr;
+    size_t pool_buffer_size_ = 0;
+#ifdef RESTORE_WITH_ZSTD
+    ZSTD_CCtx* zstd_ctx_ = nullptr;
+#endif
+};
+#endif  // RESTORE_WITH_LZ4 || RESTORE_WITH_ZSTD
+
+// 将数据完整写入文件，失败时删除不完整的文件并在 error 中给出原因
+// 直接使用系统调用(每个文件只有 open/write/close)，避免 stdio 的额外缓冲和拷贝
+bool write_file_fully(const std::string& path, const uint8_t* data, size_t size,
+                      std::string& error) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error = "无法打开输出文件 (错误码 " + std::to_string(GetLastError()) + ")";
+        return false;
+    }
+    size_t total = 0;
+    bool ok = true;
+    while (total < size) {
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(size - total, 1u << 30));
+        DWORD written = 0;
+        if (!WriteFile(file, data + total, chunk, &written, nullptr) || written == 0) {
+            error = "写入失败 (错误码 " + std::to_string(GetLastError()) + ")";
+            ok = false;
+            break;
+        }
+        total += written;
+    }
+    if (!CloseHandle(file) && ok) {
+        error = "关闭文件失败 (错误码 " + std::to_string(GetLastError()) + ")";
+        ok = false;
+    }
+    if (!ok) {
+        DeleteFileA(path.c_str());
+    }
+    return ok;
+#else
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = std::string("无法打开输出文件: ") + std::strerror(errno);
+        return false;
+    }
+    size_t total = 0;
+    bool ok = true;
+    while (total < size) {
+        ssize_t written = ::write(fd, data + total, size - total);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            error = std::string("写入失败: ") + (written < 0 ? std::strerror(errno) : "磁盘已满");
+            ok = false;
+            break;
+        }
+        total += static_cast<size_t>(written);
+    }
+    if (::close(fd) != 0 && ok) {
+        error = std::string("关闭文件失败: ") + std::strerror(errno);
+        ok = false;
+    }
+    if (!ok) {
+        ::unlink(path.c_str());
+    }
+    return ok;
+#endif
+}
+
+// 将编码后的 JPEG 数据包写入文件
+bool write_packet_to_file(const AVPacket* pkt, const std::string& output_path) {
+    std::string error;
+    if (!write_file_fully(output_path, pkt->data, pkt->size, error)) {
+        std::cerr << error << ": " << output_path << " (" << pkt->size << " 字节)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// 检查 [offset, offset + size) 处的数据是否以 JPEG 的 SOI 开头、EOI 结尾
+// 用于断点续传时廉价地识别被截断的输出，而不必重新编码比较
+static bool has_jpeg_markers(std::istream& in, uint64_t offset, uint64_t size) {
+    if (size < 4) {
+        return false;
+    }
+    unsigned char head[2] = {}, tail[2] = {};
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(offset));
+    in.read(reinterpret_cast<char*>(head), 2);
+    in.seekg(static_cast<std::streamoff>(offset + size - 2));
+    in.read(reinterpret_cast<char*>(tail), 2);
+    return in && head[0] == 0xFF && head[1] == 0xD8 && tail[0] == 0xFF && tail[1] == 0xD9;
+}
+
+// [offset, offset + size) 处是否为完整的一帧输出
+// JPEG/PNG/WebP 检查文件头和结束标记，原始格式(可能经过压缩)没有标记，只要求非空
+static bool has_valid_frame_data(std::istream& in, uint64_t offset, uint64_t size, OutputFormat format) {
+    if (format == OutputFormat::kJpeg) {
+        return has_jpeg_markers(in, offset, size);
+    }
+    if (format == OutputFormat::kPng) {
+        static const unsigned char kPngSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        static const unsigned char kPngEnd[4] = {'I', 'E', 'N', 'D'};
+        if (size < sizeof(kPngSignature) + 12) {
+            return false;
+        }
+        unsigned char head[8] = {}, tail[4] = {};
+        in.clear();
+        in.seekg(static_cast<std::streamoff>(offset));
+        in.read(reinterpret_cast<char*>(head), 8);
+        // IEND 块: 4 字节长度、4 字节类型、4 字节 CRC
+        in.seekg(static_cast<std::streamoff>(offset + size - 8));
+        in.read(reinterpret_cast<char*>(tail), 4);
+        return in && std::equal(head, head + 8, kPngSignature) && std::equal(tail, tail + 4, kPngEnd);
+    }
+    if (format == OutputFormat::kWebp) {
+        // RIFF 文件头中的长度应与实际大小一致
+        unsigned char head[12] = {};
+        if (size < sizeof(head)) {
+            return false;
+        }
+        in.clear();
+        in.seekg(static_cast<std::streamoff>(offset));
+        in.read(reinterpret_cast<char*>(head), sizeof(head));
+        uint64_t riff_size = static_cast<uint64_t>(head[4]) | (static_cast<uint64_t>(head[5]) << 8) |
+                             (static_cast<uint64_t>(head[6]) << 16) | (static_cast<uint64_t>(head[7]) << 24);
+        return in && std::memcmp(head, "RIFF", 4) == 0 && std::memcmp(head + 8, "WEBP", 4) == 0 &&
+               riff_size + 8 == size;
+    }
+    return size > 0;
+}
+
+// 已存在的输出文件是否完整
+static bool is_complete_output_file(const std::string& path, OutputFormat format) {
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    if (ec) {
+        return false;
+    }
+    std::ifstream in(path, std::ios::binary);
+    return in && has_valid_frame_data(in, 0, size, format);
+}
+
+// 打包输出: 每路视频流的所有帧追加到一个数据文件，另有紧凑的二进制索引
+// 文件均为小端格式，读取方可以直接内存映射:
+//   frames.pack: 8 字节文件头 "RSTPACK1"，之后依次为各帧的编码数据(格式由 --output-format 决定)
+//   frames.idx:  8 字节文件头 "RSTIDX01"，之后为 PackIndexEntry 数组
+// 崩溃安全: 数据先落盘，之后才追加引用这些数据的索引条目，因此索引中的条目总是有效的。
+// 运行期间索引按写入顺序追加，正常结束时按时间戳排序后原子替换
+struct PackIndexEntry {
+    int64_t timestamp;  // 索引文件中的毫秒时间戳
+    uint64_t offset;    // 帧数据在 frames.pack 中的偏移
+    uint32_t size;      // 帧数据字节数
+    uint32_t slot;      // 同步分组记录中的摄像头序号，单路输出时为 0
+};
+static_assert(sizeof(PackIndexEntry) == 24, "PackIndexEntry 布局必须固定");
+
+static const char kPackMagic[8] = {'R', 'S', 'T', 'P', 'A', 'C', 'K', '1'};
+static const char kPackIndexMagic[8] = {'R', 'S', 'T', 'I', 'D', 'X', '0', '1'};
+
+// 将 stdio 缓冲和操作系统缓存中的数据刷到磁盘
+static bool sync_file(FILE* file) {
+    if (fflush(file) != 0) {
+        return false;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+class PackWriter {
+public:
+    // flush_interval: 每追加多少帧把数据和索引刷到磁盘一次
+    // format: 帧数据的格式，续传时据此校验已有的帧
+    PackWriter(const std::string& dir, int flush_interval, OutputFormat format = OutputFormat::kJpeg)
+        : pack_path_(dir + "/frames.pack"),
+          index_path_(dir + "/frames.idx"),
+          flush_interval_(std::max(1, flush_interval)),
+          format_(format) {}
+
+    ~PackWriter() { close(); }
+
+    PackWriter(const PackWriter&) = delete;
+    PackWriter& operator=(const PackWriter&) = delete;
+
+    // resume 为 true 时保留已有打包文件中校验通过的帧，新帧追加在其后
+    bool open(bool resume) {
+        if (resume && fs::exists(pack_path_) && fs::exists(index_path_)) {
+            return open_existing();
+        }
+
+        pack_file_ = fopen(pack_path_.c_str(), "wb");
+        index_file_ = fopen(index_path_.c_str(), "wb");
+        if (!pack_file_ || !index_file_) {
+            std::cerr << "无法创建打包文件: " << pack_path_ << std::endl;
+            close();
+            return false;
+        }
+        // 数据文件是顺序追加，使用较大的缓冲区减少系统调用
+        setvbuf(pack_file_, nullptr, _IOFBF, 4 << 20);
+        if (fwrite(kPackMagic, 1, sizeof(kPackMagic), pack_file_) != sizeof(kPackMagic) ||
+            fwrite(kPackIndexMagic, 1, sizeof(kPackIndexMagic), index_file_) != sizeof(kPackIndexMagic)) {
+            std::cerr << "无法写入打包文件头: " << pack_path_ << std::endl;
+            close();
+            return false;
+        }
+        offset_ = sizeof(kPackMagic);
+        return true;
+    }
+
+    // 打包文件中已有的有效帧时间戳(按时间排序)
+    std::vector<int64_t> existing_timestamps() const {
+        std::vector<int64_t> result;
+        result.reserve(entries_.size());
+        for (const auto& entry : entries_) {
+            result.push_back(entry.timestamp);
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    // 追加一帧，可由多个写入线程同时调用
+    bool append(int64_t timestamp, const uint8_t* data, size_t size, uint32_t slot = 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!pack_file_ || failed_) {
+            return false;
+        }
+        if (fwrite(data, 1, size, pack_file_) != size) {
+            std::cerr << "写入打包文件失败: " << pack_path_ << std::endl;
+            failed_ = true;
+            return false;
+        }
+        PackIndexEntry entry{timestamp, offset_, static_cast<uint32_t>(size), slot};
+        offset_ += size;
+        entries_.push_back(entry);
+        if (entries_.size() - flushed_entries_ >= static_cast<size_t>(flush_interval_)) {
+            return flush_locked();
+        }
+        return true;
+    }
+
+    // 结束写入: 刷新剩余数据，并用按时间戳排序的索引替换追加写入的索引
+    bool close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!pack_file_ && !index_file_) {
+            return !failed_;
+        }
+        bool ok = !failed_ && pack_file_ && index_file_ && flush_locked();
+        if (pack_file_) fclose(pack_file_);
+        if (index_file_) fclose(index_file_);
+        pack_file_ = nullptr;
+        index_file_ = nullptr;
+        if (ok) {
+            ok = write_sorted_index();
+        }
+        return ok;
+    }
+
+    size_t frame_count() const { return entries_.size(); }
+
+private:
+    // 读取已有索引，只保留数据完整且通过 has_valid_frame_data 检查的条目(按输出格式检查
+    // JPEG 起止标记、PNG 签名和 IEND、WebP 的 RIFF 长度；原始格式只要求非空)，
+    // 截掉最后一个有效条目之后的数据(上次运行中断时未被索引引用的部分)
+    bool open_existing() {
+        std::error_code ec;
+        uint64_t pack_size = fs::file_size(pack_path_, ec);
+        std::ifstream pack_in(pack_path_, std::ios::binary);
+        std::ifstream index_in(index_path_, std::ios::binary);
+        char magic[8] = {};
+        pack_in.read(magic, sizeof(magic));
+        bool pack_ok = !ec && pack_in && std::equal(magic, magic + 8, kPackMagic);
+        index_in.read(magic, sizeof(magic));
+        bool index_ok = index_in && std::equal(magic, magic + 8, kPackIndexMagic);
+        if (!pack_ok || !index_ok) {
+            std::cerr << "已有打包文件无效，重新生成: " << pack_path_ << std::endl;
+            pack_in.close();
+            index_in.close();
+            return open(false);
+        }
+
+        std::map<std::pair<int64_t, uint32_t>, PackIndexEntry> valid;
+        uint64_t end = sizeof(kPackMagic);
+        PackIndexEntry entry;
+        while (index_in.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+            if (entry.offset < sizeof(kPackMagic) || entry.size < 4 ||
+                entry.offset + entry.size > pack_size ||
+                !has_valid_frame_data(pack_in, entry.offset, entry.size, format_)) {
+                continue;
+            }
+            valid[{entry.timestamp, entry.slot}] = entry;
+            end = std::max<uint64_t>(end, entry.offset + entry.size);
+        }
+        pack_in.close();
+        index_in.close();
+
+        // 用校验后的条目重写索引: 先写临时文件并落盘再原子替换，重写过程中中断时旧索引仍然完整
+        for (const auto& item : valid) {
+            entries_.push_back(item.second);
+        }
+        if (!write_sorted_index()) {
+            return false;
+        }
+        flushed_entries_ = entries_.size();
+
+        // 新索引只引用 end 之前的数据，之后才截断
+        if (end < pack_size) {
+            fs::resize_file(pack_path_, end, ec);
+            if (ec) {
+                std::cerr << "无法截断打包文件: " << pack_path_ << std::endl;
+                return false;
+            }
+        }
+
+        pack_file_ = fopen(pack_path_.c_str(), "ab");
+        index_file_ = fopen(index_path_.c_str(), "ab");
+        if (!pack_file_ || !index_file_) {
+            std::cerr << "无法打开打包文件: " << pack_path_ << std::endl;
+            close();
+            return false;
+        }
+        setvbuf(pack_file_, nullptr, _IOFBF, 4 << 20);
+        offset_ = end;
+        std::cout << "打包文件中已有 " << entries_.size() << " 帧: " << pack_path_ << std::endl;
+        return true;
+    }
+
+    bool flush_locked() {
+        if (!sync_file(pack_file_)) {
+            std::cerr << "刷新打包文件失败: " << pack_path_ << std::endl;
+            failed_ = true;
+            return false;
+        }
+        size_t pending = entries_.size() - flushed_entries_;
+        if (pending > 0 &&
+            fwrite(&entries_[flushed_entries_], sizeof(PackIndexEntry), pending, index_file_) != pending) {
+            std::cerr << "写入打包索引失败: " << index_path_ << std::endl;
+            failed_ = true;
+            return false;
+        }
+        if (!sync_file(index_file_)) {
+            std::cerr << "刷新打包索引失败: " << index_path_ << std::endl;
+            failed_ = true;
+            return false;
+        }
+        flushed_entries_ = entries_.size();
+        return true;
+    }
+
+    bool write_sorted_index() {
+        std::vector<PackIndexEntry> sorted = entries_;
+        std::sort(sorted.begin(), sorted.end(), [](const PackIndexEntry& a, const PackIndexEntry& b) {
+            return a.timestamp < b.timestamp || (a.timestamp == b.timestamp && a.slot < b.slot);
+        });
+        std::string tmp_path = index_path_ + ".tmp";
+        FILE* file = fopen(tmp_path.c_str(), "wb");
+        bool ok = file &&
+                  fwrite(kPackIndexMagic, 1, sizeof(kPackIndexMagic), file) == sizeof(kPackIndexMagic) &&
+                  (sorted.empty() ||
+                   fwrite(sorted.data(), sizeof(PackIndexEntry), sorted.size(), file) == sorted.size());
+        if (file) {
+            ok = sync_file(file) && ok;
+            fclose(file);
+        }
+        std::error_code ec;
+        if (ok) {
+            fs::rename(tmp_path, index_path_, ec);
+            ok = !ec;
+        }
+        if (!ok) {
+            std::cerr << "无法写入排序后的打包索引: " << index_path_ << std::endl;
+            fs::remove(tmp_path, ec);
+        }
+        return ok;
+    }
+
+    const std::string pack_path_;
+    const std::string index_path_;
+    const int flush_interval_;
+    const OutputFormat format_;
+    std::mutex mutex_;
+    FILE* pack_file_ = nullptr;
+    FILE* index_file_ = nullptr;
+    uint64_t offset_ = 0;
+    std::vector<PackIndexEntry> entries_;
+    size_t flushed_entries_ = 0;
+    bool failed_ = false;
+};
+
+// 保存一帧的编码结果: 打包模式下追加到打包文件，否则写入单独的文件
+bool save_packet(const AVPacket* pkt, int64_t timestamp, const std::string& output_path,
+                 PackWriter* pack, uint32_t pack_slot = 0) {
+    if (pack) {
+        return pack->append(timestamp, pkt->data, pkt->size, pack_slot);
+    }
+    return write_packet_to_file(pkt, output_path);
+}
+
+// 基于 AVBufferPool 的帧缓冲池，转换帧的缓冲区在释放后回到池中复用
+// 尺寸或像素格式变化时重建缓冲池；池中缓冲区的数量即同时在用帧数的峰值
+class FramePool {
+public:
+    FramePool() = default;
+    ~FramePool() { av_buffer_pool_uninit(&pool_); }
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // 取一帧，所有平面位于同一块池化缓冲区中，失败时返回 nullptr
+    AVFrame* get(int width, int height, AVPixelFormat format) {
+        if (!pool_ || width != width_ || height != height_ || format != format_) {
+            // 旧池在其余缓冲区归还后自动释放
+            av_buffer_pool_uninit(&pool_);
+            int size = av_image_get_buffer_size(format, width, height, kAlign);
+            if (size < 0) {
+                return nullptr;
+            }
+            pool_ = av_buffer_pool_init2(size, this, &FramePool::alloc_buffer, nullptr);
+            if (!pool_) {
+                return nullptr;
+            }
+            width_ = width;
+            height_ = height;
+            format_ = format;
+            buffer_size_ = size;
+            pool_buffers_ = 0;
+        }
+
+        AVFrame* frame = av_frame_alloc();
+        if (!frame) {
+            return nullptr;
+        }
+        frame->buf[0] = av_buffer_pool_get(pool_);
+        if (!frame->buf[0]) {
+            av_frame_free(&frame);
+            return nullptr;
+        }
+        frame->format = format;
+        frame->width = width;
+        frame->height = height;
+        av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data,
+                             format, width, height, kAlign);
+        return frame;
+    }
+
+    // 缓冲池曾经分配过的缓冲区数量(即同时在用帧数的峰值)
+    int high_water() const { return high_water_; }
+    size_t high_water_bytes() const { return static_cast<size_t>(high_water_) * buffer_size_; }
+
+private:
+    static AVBufferRef* alloc_buffer(void* opaque, size_t size) {
+        auto* self = static_cast<FramePool*>(opaque);
+        AVBufferRef* buf = av_buffer_alloc(size);
+        if (buf) {
+            int count = ++self->pool_buffers_;
+            int prev = self->high_water_.load();
+            while (count > prev && !self->high_water_.compare_exchange_weak(prev, count)) {
+            }
+        }
+        return buf;
+    }
+
+    static constexpr int kAlign = 64;
+
+    AVBufferPool* pool_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    AVPixelFormat format_ = AV_PIX_FMT_NONE;
+    size_t buffer_size_ = 0;
+    std::atomic<int> pool_buffers_{0};
+    std::atomic<int> high_water_{0};
+};
+
+// 将编码器不能直接接受的帧转换为目标像素格式(默认为 JPEG 编码器使用的全范围 YUV420P)
+// 指定输出宽高时同一次 sws_scale 内完成缩放，否则尺寸不变，swscale 会选用无缩放的 SIMD 转换路径；
+// 转换上下文和色彩范围设置按输入缓存
+class FrameConverter {
+public:
+    explicit FrameConverter(AVPixelFormat dst_format = AV_PIX_FMT_YUV420P, int dst_width = 0,
+                            int dst_height = 0)
+        : dst_format_(dst_format), dst_width_(dst_width), dst_height_(dst_height) {}
+    ~FrameConverter() { sws_freeContext(sws_ctx_); }
+
+    FrameConverter(const FrameConverter&) = delete;
+    FrameConverter& operator=(const FrameConverter&) = delete;
+
+    // 该帧是否需要缩放到其他尺寸
+    bool resizes(const AVFrame* frame) const {
+        return (dst_width_ > 0 && frame->width != dst_width_) ||
+               (dst_height_ > 0 && frame->height != dst_height_);
+    }
+
+    // 返回从缓冲池中取出的转换帧，失败时返回 nullptr
+    AVFrame* convert(const AVFrame* frame) {
+        bool src_full_range = is_full_range(frame);
+        int dst_width = dst_width_ > 0 ? dst_width_ : frame->width;
+        int dst_height = dst_height_ > 0 ? dst_height_ : frame->height;
+        // 缩放时使用双线性插值，纯格式转换保持快速路径
+        SwsContext* ctx = sws_getCachedContext(
+            sws_ctx_,
+            frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+            dst_width, dst_height, dst_format_,
+            resizes(frame) ? SWS_BILINEAR : SWS_FAST_BILINEAR, nullptr, nullptr, nullptr
+        );
+        if (!ctx) {
+            std::cerr << "无法创建图像转换上下文" << std::endl;
+            return nullptr;
+        }
+
+        // YUV 输出为 JPEG 标准的全范围数据(RGB 总是全范围)，输入范围按帧设置
+        if (ctx != sws_ctx_ || src_full_range != src_full_range_) {
+            const int* coefficients = sws_getCoefficients(SWS_CS_DEFAULT);
+            sws_setColorspaceDetails(ctx, coefficients, src_full_range ? 1 : 0,
+                                     coefficients, 1, 0, 1 << 16, 1 << 16);
+            src_full_range_ = src_full_range;
+        }
+        sws_ctx_ = ctx;
+
+        AVFrame* converted_frame = pool_.get(dst_width, dst_height, dst_format_);
+        if (!converted_frame) {
+            std::cerr << "无法分配转换帧缓冲区" << std::endl;
+            return nullptr;
+        }
+        av_frame_copy_props(converted_frame, frame);
+        converted_frame->color_range = AVCOL_RANGE_JPEG;
+
+        // 执行转换
+        int convert_ret = sws_scale(sws_ctx_,
+                  frame->data, frame->linesize, 0, frame->height,
+                  converted_frame->data, converted_frame->linesize);
+        if (convert_ret <= 0) {
+            std::cerr << "图像转换失败" << std::endl;
+            av_frame_free(&converted_frame);
+            return nullptr;
+        }
+
+        return converted_frame;
+    }
+
+    const FramePool& pool() const { return pool_; }
+
+private:
+    const AVPixelFormat dst_format_;
+    const int dst_width_;
+    const int dst_height_;
+    SwsContext* sws_ctx_ = nullptr;
+    bool src_full_range_ = false;
+    FramePool pool_;
+};
+
+// 按 (源格式, 源尺寸, 目标格式, 目标尺寸) 共享的 FrameConverter，多个输出配置做同一种转换时
+// 复用同一个转换上下文和输出帧池；不同转换可以在各自的转换线程中并发执行，同一种转换的调用互斥
+class ConverterCache {
+public:
+    ConverterCache() = default;
+    ConverterCache(const ConverterCache&) = delete;
+    ConverterCache& operator=(const ConverterCache&) = delete;
+
+    // dst_width/dst_height 不大于 0 时保持源尺寸；返回从缓冲池中取出的转换帧，失败时返回 nullptr
+    AVFrame* convert(const AVFrame* frame, AVPixelFormat dst_format, int dst_width, int dst_height) {
+        Entry& entry = find(frame, dst_format, dst_width, dst_height);
+        std::lock_guard<std::mutex> lock(entry.mutex);
+        return entry.converter.convert(frame);
+    }
+
+    // 所有转换输出帧池的峰值占用
+    void report_pool_usage(std::ostream& os) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int frames = 0;
+        size_t bytes = 0;
+        for (const auto& [key, entry] : entries_) {
+            frames += entry->converter.pool().high_water();
+            bytes += entry->converter.pool().high_water_bytes();
+        }
+        if (frames > 0) {
+            os << "转换帧池峰值: " << frames << " 帧, " << bytes / (1024 * 1024) << " MB ("
+               << entries_.size() << " 种转换)" << std::endl;
+        }
+    }
+
+private:
+    using Key = std::array<int, 6>;
+
+    struct Entry {
+        Entry(AVPixelFormat format, int width, int height) : converter(format, width, height) {}
+        std::mutex mutex;
+        FrameConverter converter;
+    };
+
+    Entry& find(const AVFrame* frame, AVPixelFormat dst_format, int dst_width, int dst_height) {
+        int width = dst_width > 0 ? dst_width : frame->width;
+        int height = dst_height > 0 ? dst_height : frame->height;
+        Key key{frame->format, frame->width, frame->height, dst_format, width, height};
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::unique_ptr<Entry>& entry = entries_[key];
+        if (!entry) {
+            entry = std::make_unique<Entry>(dst_format, width, height);
+        }
+        return *entry;
+    }
+
+    mutable std::mutex mutex_;
+    std::map<Key, std::unique_ptr<Entry>> entries_;
+};
+
+// 将硬件帧取回系统内存，返回软件帧，失败时返回 nullptr
+// map 为 true 时先尝试零拷贝映射，不支持时拷贝到 pool 中的缓冲区
+AVFrame* download_hw_frame(const AVFrame* frame, bool map, FramePool& pool) {
+    auto* frames_ctx = reinterpret_cast<AVHWFramesContext*>(frame->hw_frames_ctx->data);
+    if (map) {
+        AVFrame* mapped = av_frame_alloc();
+        if (!mapped) {
+            std::cerr << "无法分配软件帧" << std::endl;
+            return nullptr;
+        }
+        mapped->format = frames_ctx->sw_format;
+        if (av_hwframe_map(mapped, frame, AV_HWFRAME_MAP_READ) >= 0) {
+            return mapped;
+        }
+        av_frame_free(&mapped);
+    }
+
+    AVFrame* sw_frame = pool.get(frame->width, frame->height, frames_ctx->sw_format);
+    if (!sw_frame) {
+        std::cerr << "无法分配软件帧" << std::endl;
+        return nullptr;
+    }
+
+    int ret = av_hwframe_transfer_data(sw_frame, frame, 0);
+    if (ret < 0) {
+        std::cerr << "无法从硬件取回帧: " << av_err2str(ret) << std::endl;
+        av_frame_free(&sw_frame);
+        return nullptr;
+    }
+    av_frame_copy_props(sw_frame, frame);
+    return sw_frame;
+}
+
+// 能直接编码该硬件帧的 FFmpeg JPEG 编码器名称，软件帧或设备没有 JPEG 编码器(如 CUDA)时返回 nullptr
+static const char* gpu_jpeg_encoder_name(const AVFrame* frame) {
+    if (!frame->hw_frames_ctx) {
+        return nullptr;
+    }
+    auto* frames_ctx = reinterpret_cast<AVHWFramesContext*>(frame->hw_frames_ctx->data);
+    const char* name = nullptr;
+    switch (frames_ctx->device_ctx->type) {
+    case AV_HWDEVICE_TYPE_VAAPI:
+        name = "mjpeg_vaapi";
+        break;
+    case AV_HWDEVICE_TYPE_QSV:
+        name = "mjpeg_qsv";
+        break;
+    default:
+        return nullptr;
+    }
+    return avcodec_find_encoder_by_name(name) ? name : nullptr;
+}
+
+// GPU JPEG 编码器 (VAAPI / QSV 的 MJPEG 编码器)
+// 直接编码硬件解码得到的表面，帧数据不离开设备，只有 JPEG 码流传回系统内存
+// 软件帧交给 CPU 编码器；GPU 编码器不可用或失败后，硬件帧取回系统内存再由 CPU 编码
+class GpuJpegEncoder : public FrameEncoder {
+public:
+    GpuJpegEncoder(int quality, int thread_count)
+        : quality_(quality), fallback_(std::make_unique<JpegEncoder>(quality, thread_count)) {}
+    ~GpuJpegEncoder() override { close(); }
+
+    GpuJpegEncoder(const GpuJpegEncoder&) = delete;
+    GpuJpegEncoder& operator=(const GpuJpegEncoder&) = delete;
+
+    const char* name() const override { return "gpu"; }
+
+    AVPacket* encode(const AVFrame* frame) override {
+        if (!frame->hw_frames_ctx) {
+            return fallback_->encode(frame);
+        }
+        if (!failed_) {
+            if (AVPacket* pkt = encode_on_device(frame)) {
+                return pkt;
+            }
+            std::cerr << "GPU JPEG 编码不可用，改用 CPU 编码" << std::endl;
+            failed_ = true;
+            close();
+        }
+
+        AVFrame* sw_frame = download_hw_frame(frame, false, download_pool_);
+        if (!sw_frame) {
+            return nullptr;
+        }
+        if (!is_jpeg_native_frame(sw_frame)) {
+            AVFrame* converted_frame = converter_.convert(sw_frame);
+            av_frame_free(&sw_frame);
+            if (!converted_frame) {
+                return nullptr;
+            }
+            sw_frame = converted_frame;
+        }
+        AVPacket* pkt = fallback_->encode(sw_frame);
+        av_frame_free(&sw_frame);
+        return pkt;
+    }
+
+private:
+    AVPacket* encode_on_device(const AVFrame* frame) {
+        if (!ensure_open(frame)) {
+            return nullptr;
+        }
+        av_packet_unref(pkt_);
+        int ret = avcodec_send_frame(ctx_, frame);
+        if (ret < 0) {
+            std::cerr << "发送帧到 GPU 编码器失败: " << av_err2str(ret) << std::endl;
+            return nullptr;
+        }
+        ret = avcodec_receive_packet(ctx_, pkt_);
+        if (ret < 0) {
+            std::cerr << "接收 GPU 编码数据包失败: " << av_err2str(ret) << std::endl;
+            return nullptr;
+        }
+        return pkt_;
+    }
+
+    // 编码器绑定到帧所在的硬件帧池，帧池或尺寸变化时重建
+    bool ensure_open(const AVFrame* frame) {
+        if (ctx_ && frame->hw_frames_ctx->data == ctx_->hw_frames_ctx->data &&
+            frame->width == ctx_->width && frame->height == ctx_->height) {
+            return true;
+        }
+        close();
+
+        const char* encoder_name = gpu_jpeg_encoder_name(frame);
+        const AVCodec* codec = encoder_name ? avcodec_find_encoder_by_name(encoder_name) : nullptr;
+        if (!codec) {
+            return false;
+        }
+        ctx_ = avcodec_alloc_context3(codec);
+        pkt_ = av_packet_alloc();
+        if (!ctx_ || !pkt_) {
+            std::cerr << "无法分配 GPU JPEG 编码器上下文" << std::endl;
+            close();
+            return false;
+        }
+        ctx_->pix_fmt = static_cast<AVPixelFormat>(frame->format);
+        ctx_->hw_frames_ctx = av_buffer_ref(frame->hw_frames_ctx);
+        ctx_->width = frame->width;
+        ctx_->height = frame->height;
+        ctx_->time_base = {1, 30};
+        // 硬件 MJPEG 编码器的 global_quality 直接是 1-100 的 JPEG 质量
+        ctx_->global_quality = std::min(100, std::max(1, quality_));
+
+        int ret = avcodec_open2(ctx_, codec, nullptr);
+        if (ret < 0) {
+            std::cerr << "无法打开 GPU JPEG 编码器 " << encoder_name << ": " << av_err2str(ret) << std::endl;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        avcodec_free_context(&ctx_);
+        av_packet_free(&pkt_);
+    }
+
+    const int quality_;
+    std::unique_ptr<FrameEncoder> fallback_;
+    AVCodecContext* ctx_ = nullptr;
+    AVPacket* pkt_ = nullptr;
+    bool failed_ = false;
+    FramePool download_pool_;
+    FrameConverter converter_;
+};
+
+std::unique_ptr<FrameEncoder> create_gpu_jpeg_encoder(int quality, int thread_count) {
+    return std::make_unique<GpuJpegEncoder>(quality, thread_count);
+}
+
+// ---- 静止画面检测 ----
+// 亮度平面缩小为 kGrid x kGrid 的块均值作为签名(隔行采样)，与上一个保留帧的签名比较，
+// 平均绝对差(灰度 0-255)低于阈值的帧视为重复。行内求和是连续字节累加，编译器可自动向量化
+class FrameDeduplicator {
+public:
+    static constexpr int kGrid = 16;
+
+    explicit FrameDeduplicator(double threshold) : threshold_(threshold) {}
+
+    // 返回 true 表示与上一个保留帧重复；不是 8 位平面亮度的帧(硬件帧、RGB)不检测，总是保留
+    bool duplicate(const AVFrame* frame) {
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+        if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_RGB)) ||
+            desc->comp[0].depth != 8 || desc->comp[0].step != 1 ||
+            frame->width < kGrid || frame->height < kGrid) {
+            return false;
+        }
+
+        compute_signature(frame, current_);
+        if (has_reference_) {
+            int difference = 0;
+            for (size_t i = 0; i < current_.size(); i++) {
+                difference += std::abs(static_cast<int>(current_[i]) - static_cast<int>(reference_[i]));
+            }
+            if (difference < threshold_ * current_.size()) {
+                return true;
+            }
+        }
+        reference_.swap(current_);
+        has_reference_ = true;
+        return false;
+    }
+
+private:
+    using Signature = std::array<uint8_t, kGrid * kGrid>;
+
+    static void compute_signature(const AVFrame* frame, Signature& signature) {
+        const int row_step = 2;
+        for (int by = 0; by < kGrid; by++) {
+            int y0 = by * frame->height / kGrid;
+            int y1 = (by + 1) * frame->height / kGrid;
+            uint32_t sums[kGrid] = {};
+            int rows = 0;
+            for (int y = y0; y < y1; y += row_step, rows++) {
+                const uint8_t* row = frame->data[0] + static_cast<ptrdiff_t>(y) * frame->linesize[0];
+                for (int bx = 0; bx < kGrid; bx++) {
+                    int x0 = bx * frame->width / kGrid;
+                    int x1 = (bx + 1) * frame->width / kGrid;
+                    uint32_t sum = 0;
+                    for (int x = x0; x < x1; x++) {
+                        sum += row[x];
+                    }
+                    sums[bx] += sum;
+                }
+            }
+            for (int bx = 0; bx < kGrid; bx++) {
+                int width = (bx + 1) * frame->width / kGrid - bx * frame->width / kGrid;
+                signature[by * kGrid + bx] = static_cast<uint8_t>(sums[bx] / (static_cast<uint32_t>(width) * rows));
+            }
+        }
+    }
+
+    const double threshold_;
+    Signature reference_{};
+    Signature current_{};
+    bool has_reference_ = false;
+};
+
+// 读取重复帧记录(每行 "重复帧时间戳 保留帧时间戳")中的重复帧时间戳，按时间排序；文件不存在时返回空
+std::vector<int64_t> read_duplicate_timestamps(const std::string& path) {
+    std::vector<int64_t> result;
+    std::ifstream in(path);
+    int64_t duplicate = 0;
+    int64_t kept = 0;
+    while (in >> duplicate >> kept) {
+        result.push_back(duplicate);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+// ---- 鱼眼去畸变 ----
+// 鱼眼相机标定参数 (Kannala-Brandt 等距模型，与 OpenCV cv::fisheye 相同):
+//   theta_d = theta * (1 + k1*theta^2 + k2*theta^4 + k3*theta^6 + k4*theta^8)
+// 输出为针孔投影，视场角为 out_fov 度；out_width/out_height 为 0 时与输入尺寸相同
+struct FisheyeCalibration {
+    int width = 0;   // 标定时的图像尺寸，解码帧尺寸不同时内参按比例缩放
+    int height = 0;
+    double fx = 0.0, fy = 0.0, cx = 0.0, cy = 0.0;
+    double k1 = 0.0, k2 = 0.0, k3 = 0.0, k4 = 0.0;
+    int out_width = 0;
+    int out_height = 0;
+    double out_fov = 120.0;
+};
+
+// 读取标定文件: 每行 "键 值"，# 开头为注释
+bool load_fisheye_calibration(const std::string& path, FisheyeCalibration& calib) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cerr << "无法打开标定文件: " << path << std::endl;
+        return false;
+    }
+    std::map<std::string, double*> doubles = {
+        {"fx", &calib.fx}, {"fy", &calib.fy}, {"cx", &calib.cx}, {"cy", &calib.cy},
+        {"k1", &calib.k1}, {"k2", &calib.k2}, {"k3", &calib.k3}, {"k4", &calib.k4},
+        {"out_fov", &calib.out_fov},
+    };
+    std::map<std::string, int*> ints = {
+        {"width", &calib.width}, {"height", &calib.height},
+        {"out_width", &calib.out_width}, {"out_height", &calib.out_height},
+    };
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key) || key[0] == '#') {
+            continue;
+        }
+        bool ok = false;
+        if (doubles.count(key)) {
+            ok = static_cast<bool>(fields >> *doubles[key]);
+        } else if (ints.count(key)) {
+            ok = static_cast<bool>(fields >> *ints[key]);
+        }
+        if (!ok) {
+            std::cerr << "标定文件中无效的行: " << line << " (" << path << ")" << std::endl;
+            return false;
+        }
+    }
+    if (calib.width <= 0 || calib.height <= 0 || calib.fx <= 0.0 || calib.fy <= 0.0 ||
+        calib.out_fov <= 0.0 || calib.out_fov >= 180.0) {
+        std::cerr << "标定文件缺少尺寸/焦距或视场角无效: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// 常驻的小线程组，把一帧的行区间分给各线程并行处理，调用线程处理第一段
+class ParallelRows {
+public:
+    explicit ParallelRows(int threads) {
+        for (int i = 1; i < threads; i++) {
+            workers_.emplace_back(&ParallelRows::worker_loop, this, i);
+        }
+    }
+
+    ~ParallelRows() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_cv_.notify_all();
+        for (auto& t : workers_) {
+            t.join();
+        }
+    }
+
+    ParallelRows(const ParallelRows&) = delete;
+    ParallelRows& operator=(const ParallelRows&) = delete;
+
+    // 对 [0, rows) 分段调用 fn(begin, end)，所有段完成后返回
+    void run(int rows, const std::function<void(int, int)>& fn) {
+        if (workers_.empty()) {
+            fn(0, rows);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            fn_ = &fn;
+            rows_ = rows;
+            pending_ = workers_.size();
+            generation_++;
+        }
+        start_cv_.notify_all();
+        run_part(0, rows, fn);
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this] { return pending_ == 0; });
+    }
+
+private:
+    void run_part(int part, int rows, const std::function<void(int, int)>& fn) const {
+        int parts = static_cast<int>(workers_.size()) + 1;
+        int begin = static_cast<int>(static_cast<int64_t>(rows) * part / parts);
+        int end = static_cast<int>(static_cast<int64_t>(rows) * (part + 1) / parts);
+        if (begin < end) {
+            fn(begin, end);
+        }
+    }
+
+    void worker_loop(int part) {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            start_cv_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_) {
+                return;
+            }
+            seen = generation_;
+            const std::function<void(int, int)>* fn = fn_;
+            int rows = rows_;
+            lock.unlock();
+            run_part(part, rows, *fn);
+            lock.lock();
+            if (--pending_ == 0) {
+                done_cv_.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    const std::function<void(int, int)>* fn_ = nullptr;
+    int rows_ = 0;
+    size_t pending_ = 0;
+    uint64_t generation_ = 0;
+    bool stop_ = false;
+};
+
+// 基于查找表的鱼眼去畸变: 查找表只在第一帧(或帧尺寸变化)时按标定参数生成一次，
+// 每个输出像素记录源图像中左上角邻点的坐标和 8 位定点双线性权重，逐帧只做整数运算
+// 亮度和色度平面各有一张表，直接按目标输出尺寸生成，去畸变和缩小在同一遍中完成
+class FisheyeRemapper {
+public:
+    // out_width/out_height 大于 0 时覆盖标定文件中的输出尺寸
+    FisheyeRemapper(const FisheyeCalibration& calib, int out_width, int out_height, int threads)
+        : calib_(calib), requested_width_(out_width), requested_height_(out_height),
+          rows_(std::max(1, threads)) {}
+
+    FisheyeRemapper(const FisheyeRemapper&) = delete;
+    FisheyeRemapper& operator=(const FisheyeRemapper&) = delete;
+
+    // 输入须为 YUV420P/YUVJ420P，返回从 pool 中取出的去畸变帧，失败时返回 nullptr
+    AVFrame* remap(const AVFrame* frame, FramePool& pool) {
+        if (frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_YUVJ420P) {
+            std::cerr << "去畸变不支持的像素格式: "
+                      << av_get_pix_fmt_name(static_cast<AVPixelFormat>(frame->format)) << std::endl;
+            return nullptr;
+        }
+        if (frame->width != src_width_ || frame->height != src_height_) {
+            build_tables(frame->width, frame->height);
+        }
+
+        AVFrame* out = pool.get(out_width_, out_height_, static_cast<AVPixelFormat>(frame->format));
+        if (!out) {
+            std::cerr << "无法分配去畸变帧缓冲区" << std::endl;
+            return nullptr;
+        }
+        av_frame_copy_props(out, frame);
+
+        const bool full_range = is_full_range(frame);
+        rows_.run(out_height_, [&](int begin, int end) {
+            remap_plane(luma_, out_width_, begin, end, frame->data[0], frame->linesize[0],
+                        out->data[0], out->linesize[0], full_range ? 0 : 16);
+            // 色度行按亮度行的一半划分，各段互不重叠
+            int chroma_height = AV_CEIL_RSHIFT(out_height_, 1);
+            int chroma_begin = AV_CEIL_RSHIFT(begin, 1);
+            int chroma_end = end == out_height_ ? chroma_height : AV_CEIL_RSHIFT(end, 1);
+            for (int plane = 1; plane < 3; plane++) {
+                remap_plane(chroma_, AV_CEIL_RSHIFT(out_width_, 1), chroma_begin, chroma_end,
+                            frame->data[plane], frame->linesize[plane],
+                            out->data[plane], out->linesize[plane], 128);
+            }
+        });
+        return out;
+    }
+
+    int out_width() const { return out_width_; }
+    int out_height() const { return out_height_; }
+
+private:
+    // 源坐标 (x, y) 为左上角邻点，wx/wy 为 0-256 的右/下邻点权重；x < 0 表示落在视场之外
+    struct RemapEntry {
+        int16_t x;
+        int16_t y;
+        uint16_t wx;
+        uint16_t wy;
+    };
+
+    void build_tables(int src_width, int src_height) {
+        src_width_ = src_width;
+        src_height_ = src_height;
+        out_width_ = requested_width_ > 0 ? requested_width_
+                     : calib_.out_width > 0 ? calib_.out_width : src_width;
+        out_height_ = requested_height_ > 0 ? requested_height_
+                      : calib_.out_height > 0 ? calib_.out_height : src_height;
+        out_width_ = (out_width_ + 1) & ~1;
+        out_height_ = (out_height_ + 1) & ~1;
+
+        build_table(luma_, 1, src_width, src_height);
+        build_table(chroma_, 2, AV_CEIL_RSHIFT(src_width, 1), AV_CEIL_RSHIFT(src_height, 1));
+        std::cout << "去畸变查找表: " << src_width << "x" << src_height << " -> "
+                  << out_width_ << "x" << out_height_ << " (视场角 " << calib_.out_fov << " 度)" << std::endl;
+    }
+
+    // scale 为该平面相对亮度平面的下采样倍数，plane_width/plane_height 为源平面尺寸
+    void build_table(std::vector<RemapEntry>& table, int scale, int plane_width, int plane_height) {
+        const int width = AV_CEIL_RSHIFT(out_width_, scale - 1);
+        const int height = AV_CEIL_RSHIFT(out_height_, scale - 1);
+        const double sx = static_cast<double>(src_width_) / calib_.width;
+        const double sy = static_cast<double>(src_height_) / calib_.height;
+        const double fx = calib_.fx * sx, fy = calib_.fy * sy;
+        const double cx = calib_.cx * sx, cy = calib_.cy * sy;
+        const double out_f = (out_width_ / 2.0) / std::tan(calib_.out_fov * kPi / 360.0);
+        const double out_cx = (out_width_ - 1) / 2.0, out_cy = (out_height_ - 1) / 2.0;
+
+        table.resize(static_cast<size_t>(width) * height);
+        for (int v = 0; v < height; v++) {
+            for (int u = 0; u < width; u++) {
+                // 平面像素中心换算到亮度坐标，经过投影再换算回源平面坐标
+                double x = ((u + 0.5) * scale - 0.5 - out_cx) / out_f;
+                double y = ((v + 0.5) * scale - 0.5 - out_cy) / out_f;
+                double r = std::sqrt(x * x + y * y);
+                double theta = std::atan(r);
+                double theta2 = theta * theta;
+                double theta_d = theta * (1 + theta2 * (calib_.k1 + theta2 * (calib_.k2 + theta2 *
+                                          (calib_.k3 + theta2 * calib_.k4))));
+                double d = r > 1e-9 ? theta_d / r : 1.0;
+                double src_x = ((fx * x * d + cx) + 0.5) / scale - 0.5;
+                double src_y = ((fy * y * d + cy) + 0.5) / scale - 0.5;
+
+                RemapEntry& entry = table[static_cast<size_t>(v) * width + u];
+                if (src_x < 0 || src_y < 0 || src_x > plane_width - 1 || src_y > plane_height - 1) {
+                    entry = RemapEntry{-1, -1, 0, 0};
+                    continue;
+                }
+                // 右/下邻点须在平面之内
+                int ix = std::min(static_cast<int>(src_x), plane_width - 2);
+                int iy = std::min(static_cast<int>(src_y), plane_height - 2);
+                entry.x = static_cast<int16_t>(ix);
+                entry.y = static_cast<int16_t>(iy);
+                entry.wx = static_cast<uint16_t>(std::lround((src_x - ix) * 256));
+                entry.wy = static_cast<uint16_t>(std::lround((src_y - iy) * 256));
+            }
+        }
+    }
+
+    static void remap_plane(const std::vector<RemapEntry>& table, int width, int begin, int end,
+                            const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride,
+                            uint8_t fill) {
+        for (int v = begin; v < end; v++) {
+            const RemapEntry* entry = &table[static_cast<size_t>(v) * width];
+            uint8_t* out = dst + static_cast<ptrdiff_t>(v) * dst_stride;
+            for (int u = 0; u < width; u++, entry++) {
+                if (entry->x < 0) {
+                    out[u] = fill;
+                    continue;
+                }
+                const uint8_t* p = src + static_cast<ptrdiff_t>(entry->y) * src_stride + entry->x;
+                uint32_t wx = entry->wx, wy = entry->wy;
+                uint32_t top = p[0] * (256 - wx) + p[1] * wx;
+                uint32_t bottom = p[src_stride] * (256 - wx) + p[src_stride + 1] * wx;
+                out[u] = static_cast<uint8_t>((top * (256 - wy) + bottom * wy + 32768) >> 16);
+            }
+        }
+    }
+
+    static constexpr double kPi = 3.14159265358979323846;
+
+    const FisheyeCalibration calib_;
+    const int requested_width_;
+    const int requested_height_;
+    ParallelRows rows_;
+    int src_width_ = 0;
+    int src_height_ = 0;
+    int out_width_ = 0;
+    int out_height_ = 0;
+    std::vector<RemapEntry> luma_;
+    std::vector<RemapEntry> chroma_;
+};
+
+// ---- 运行统计 ----
+// 热路径上只做线程本地的计数: 每个线程持有自己的直方图，线程结束时加锁合并一次
+
+using SteadyClock = std::chrono::steady_clock;
+
+static inline int64_t elapsed_ns(SteadyClock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(SteadyClock::now() - start).count();
+}
+
+// 对数分桶的延迟直方图，每个 2 的幂区间再分 4 个子桶(相对误差约 19%)
+class LatencyHistogram {
+public:
+    void record(int64_t ns) {
+        if (ns < 1) ns = 1;
+        buckets_[bucket_of(static_cast<uint64_t>(ns))]++;
+        count_++;
+        total_ns_ += ns;
+        max_ns_ = std::max(max_ns_, ns);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < buckets_.size(); i++) {
+            buckets_[i] += other.buckets_[i];
+        }
+        count_ += other.count_;
+        total_ns_ += other.total_ns_;
+        max_ns_ = std::max(max_ns_, other.max_ns_);
+    }
+
+    // 返回分位数所在子桶的上界(纳秒)，p 取值 0-1
+    int64_t percentile(double p) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(count_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets_.size(); i++) {
+            seen += buckets_[i];
+            if (seen >= rank) {
+                return std::min(upper_bound_of(i), max_ns_);
+            }
+        }
+        return max_ns_;
+    }
+
+    uint64_t count() const { return count_; }
+    int64_t total_ns() const { return total_ns_; }
+    int64_t max_ns() const { return max_ns_; }
+
+private:
+    static constexpr int kSubBits = 2;
+
+    static size_t bucket_of(uint64_t v) {
+        int log2 = 63 - __builtin_clzll(v);
+        if (log2 < kSubBits) {
+            return static_cast<size_t>(v);
+        }
+        uint64_t sub = (v >> (log2 - kSubBits)) & ((1u << kSubBits) - 1);
+        return (static_cast<size_t>(log2 - kSubBits + 1) << kSubBits) + sub;
+    }
+
+    static int64_t upper_bound_of(size_t bucket) {
+        size_t group = bucket >> kSubBits;
+        uint64_t sub = bucket & ((1u << kSubBits) - 1);
+        if (group == 0) {
+            return static_cast<int64_t>(sub);
+        }
+        int log2 = static_cast<int>(group) + kSubBits - 1;
+        uint64_t base = 1ull << log2;
+        uint64_t step = base >> kSubBits;
+        return static_cast<int64_t>(base + (sub + 1) * step - 1);
+    }
+
+    std::array<uint64_t, (64 - kSubBits + 1) << kSubBits> buckets_{};
+    uint64_t count_ = 0;
+    int64_t total_ns_ = 0;
+    int64_t max_ns_ = 0;
+};
+
+// 流水线各阶段
+enum Stage { kStageDemux, kStageDecode, kStageConvert, kStageEncode, kStageWrite, kStageCount };
+static const char* const kStageNames[kStageCount] = {"demux", "decode", "convert", "encode", "write"};
+
+// 队列占用情况，在入队时(已持有队列锁)采样
+struct QueueStats {
+    size_t capacity = 0;
+    size_t max_size = 0;
+    uint64_t samples = 0;
+    uint64_t size_sum = 0;
+
+    double average() const { return samples ? static_cast<double>(size_sum) / samples : 0.0; }
+};
+
+// 单路视频流的统计数据
+// 进度计数器为原子变量，可随时读取；延迟直方图和队列统计在各线程结束时合并
+struct StreamStats {
+    std::string camera;
+    SteadyClock::time_point start = SteadyClock::now();
+    std::atomic<bool> started{false};
+    std::atomic<bool> success{false};
+    std::atomic<double> seconds{0.0};
+    std::atomic<uint64_t> frames_decoded{0};
+    std::atomic<uint64_t> frames_written{0};
+    std::atomic<uint64_t> frames_deduplicated{0};
+    std::atomic<uint64_t> bytes_written{0};
+
+    // 各阶段的错误计数
+    std::atomic<uint64_t> decode_errors{0};   // 送入数据包或取出帧失败
+    std::atomic<uint64_t> convert_errors{0};  // 取回硬件帧、裁剪或像素转换失败
+    std::atomic<uint64_t> encode_errors{0};
+    std::atomic<uint64_t> write_errors{0};
+
+    std::mutex mutex;
+    LatencyHistogram stages[kStageCount];
+    std::map<std::string, QueueStats> queues;
+    std::string error;  // 导致该路失败的第一个原因(见 fail)，供调度方判断是否重试
+
+    // 记录失败原因，只保留第一个: index / video / decoder / decode_errors / output 等
+    void fail(const std::string& reason) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error.empty()) {
+            error = reason;
+        }
+    }
+
+    void merge(Stage stage, const LatencyHistogram& histogram) {
+        std::lock_guard<std::mutex> lock(mutex);
+        stages[stage].merge(histogram);
+    }
+
+    void set_queue(const std::string& name, const QueueStats& queue) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queues[name] = queue;
+    }
+};
+
+// JSON 字符串转义
+static std::string json_escape(const std::string& value) {
+    std::string out;
+    out.reserve(value.size() + 2);
+    for (char c : value) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+    }
+    return out;
+}
+
+// 输出单路视频流的统计 JSON 对象；final 为 false 时只输出进度计数
+static void write_stream_stats_json(std::ostream& os, StreamStats& stats, bool final) {
+    double seconds = final || !stats.started ? stats.seconds.load()
+                           : std::chrono::duration<double>(SteadyClock::now() - stats.start).count();
+    uint64_t written = stats.frames_written;
+    os << "{\"camera\":\"" << json_escape(stats.camera) << "\""
+       << ",\"seconds\":" << seconds
+       << ",\"frames_decoded\":" << stats.frames_decoded
+       << ",\"frames_written\":" << written
+       << ",\"frames_deduplicated\":" << stats.frames_deduplicated
+       << ",\"fps\":" << (seconds > 0 ? written / seconds : 0.0)
+       << ",\"bytes_written\":" << stats.bytes_written
+       << ",\"errors\":{\"decode\":" << stats.decode_errors
+       << ",\"convert\":" << stats.convert_errors
+       << ",\"encode\":" << stats.encode_errors
+       << ",\"write\":" << stats.write_errors << "}";
+    if (final) {
+        std::lock_guard<std::mutex> lock(stats.mutex);
+        os << ",\"success\":" << (stats.success ? "true" : "false");
+        if (!stats.error.empty()) {
+            os << ",\"error\":\"" << json_escape(stats.error) << "\"";
+        }
+        os << ",\"stages\":{";
+        for (int i = 0; i < kStageCount; i++) {
+            const LatencyHistogram& h = stats.stages[i];
+            os << (i ? "," : "") << "\"" << kStageNames[i] << "\":{"
+               << "\"count\":" << h.count()
+               << ",\"total_ms\":" << h.total_ns() / 1e6
+               << ",\"p50_us\":" << h.percentile(0.50) / 1e3
+               << ",\"p90_us\":" << h.percentile(0.90) / 1e3
+               << ",\"p99_us\":" << h.percentile(0.99) / 1e3
+               << ",\"max_us\":" << h.max_ns() / 1e3 << "}";
+        }
+        os << "},\"queues\":{";
+        bool first = true;
+        for (const auto& item : stats.queues) {
+            os << (first ? "" : ",") << "\"" << item.first << "\":{"
+               << "\"capacity\":" << item.second.capacity
+               << ",\"max\":" << item.second.max_size
+               << ",\"avg\":" << item.second.average() << "}";
+            first = false;
+        }
+        os << "}";
+    }
+    os << "}";
+}
+
+// 帧引用的所有缓冲区的总字节数
+static size_t frame_buffer_bytes(const AVFrame* frame) {
+    size_t bytes = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+        bytes += frame->buf[i]->size;
+    }
+    for (int i = 0; i < frame->nb_extended_buf; i++) {
+        bytes += frame->extended_buf[i]->size;
+    }
+    return bytes;
+}
+
+// 全局内存预算: 限制流水线中在途的解码帧、转换帧和编码数据包占用的内存
+// 记账以 AVBufferRef 挂在帧或数据包的 opaque_ref 上，帧/包在任何路径上释放时自动归还；
+// av_frame_clone 和 av_frame_copy_props 会复制 opaque_ref: 送往多个输出配置的同一解码帧只记账一次，
+// 流水线自己分配的帧(取回、转换、去畸变得到的帧)用 charge_frame 换成按自身大小记账的令牌
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t capacity) : capacity_(capacity) {}
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    // 等待预算足够后记账 bytes，用于流水线入口的反压；预算全空时单次超出也放行，避免永久阻塞
+    AVBufferRef* acquire(size_t bytes) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        released_.wait(lock, [&] { return in_use_ == 0 || in_use_ + bytes <= capacity_; });
+        return account(bytes);
+    }
+
+    // 不等待直接记账，用于流水线内部的阶段，避免反压在阶段之间形成环路
+    AVBufferRef* charge(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return account(bytes);
+    }
+
+    // 解码帧进入流水线前记账(等待预算)；帧已挂有本预算的令牌时不重复记账
+    void acquire_frame(AVFrame* frame) {
+        if (owns(frame->opaque_ref)) {
+            return;
+        }
+        av_buffer_unref(&frame->opaque_ref);
+        frame->opaque_ref = acquire(frame_buffer_bytes(frame));
+    }
+
+    // 流水线内部新分配的帧: 从源帧复制来的令牌换成按该帧大小记账的令牌(不等待)
+    void charge_frame(AVFrame* frame) {
+        av_buffer_unref(&frame->opaque_ref);
+        frame->opaque_ref = charge(frame_buffer_bytes(frame));
+    }
+
+    size_t capacity() const { return capacity_; }
+    size_t peak() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return peak_;
+    }
+
+private:
+    struct Token {
+        MemoryBudget* budget;
+        size_t bytes;
+    };
+
+    AVBufferRef* account(size_t bytes) {
+        auto* token = new Token{this, bytes};
+        AVBufferRef* ref = av_buffer_create(reinterpret_cast<uint8_t*>(token), sizeof(Token),
+                                            &MemoryBudget::release, this, 0);
+        if (!ref) {
+            delete token;
+            return nullptr;
+        }
+        in_use_ += bytes;
+        peak_ = std::max(peak_, in_use_);
+        return ref;
+    }
+
+    bool owns(const AVBufferRef* ref) const { return ref && av_buffer_get_opaque(ref) == this; }
+
+    static void release(void*, uint8_t* data) {
+        auto* token = reinterpret_cast<Token*>(data);
+        {
+            std::lock_guard<std::mutex> lock(token->budget->mutex_);
+            token->budget->in_use_ -= token->bytes;
+        }
+        token->budget->released_.notify_all();
+        delete token;
+    }
+
+    const size_t capacity_;
+    mutable std::mutex mutex_;
+    std::condition_variable released_;
+    size_t in_use_ = 0;
+    size_t peak_ = 0;
+};
+
+// 进程的峰值常驻内存(字节)
+size_t peak_rss_bytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);  // macOS 以字节为单位
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// 有界阻塞队列，用于连接流水线各阶段
+// 队列满时生产者阻塞，从而对上游形成反压，限制内存占用
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(1, capacity)) {}
+
+    // 放入一个元素，队列已关闭时返回 false
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        stats_.max_size = std::max(stats_.max_size, items_.size());
+        stats_.size_sum += items_.size();
+        stats_.samples++;
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // 取出一个元素，队列已关闭且为空时返回 false
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        lock.unlock();
+        not_full_.notify_one();
+        return true;
+    }
+
+    // 一次取出最多 max_items 个元素追加到 items，减少加锁次数
+    // 队列已关闭且为空时返回 false
+    bool pop_batch(std::vector<T>& items, size_t max_items) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        while (!items_.empty() && max_items-- > 0) {
+            items.push_back(std::move(items_.front()));
+            items_.pop_front();
+        }
+        lock.unlock();
+        not_full_.notify_all();
+        return true;
+    }
+
+    QueueStats stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        QueueStats result = stats_;
+        result.capacity = capacity_;
+        return result;
+    }
+
+    // 关闭队列: 不再接受新元素，消费者取完剩余元素后退出
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    std::deque<T> items_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    bool closed_ = false;
+    QueueStats stats_;
+};
+
+// 输出配置: 同一次解码按各配置分别裁剪、缩放和编码，输出到 <输出目录>/<name>
+// crop_width 为 0 表示不裁剪；尺寸、格式和质量为 0 或空时沿用全局选项
+struct OutputProfile {
+    std::string name;
+    int crop_x = 0;
+    int crop_y = 0;
+    int crop_width = 0;
+    int crop_height = 0;
+    int output_width = 0;
+    int output_height = 0;
+    std::string output_format;
+    int jpeg_quality = 0;
+};
+
+// 提取参数
+struct ExtractOptions {
+    int queue_depth = 8;     // 每个阶段之间的队列深度，0 表示在解码线程内同步处理
+    int encode_threads = 2;  // JPEG 编码线程数
+    int jpeg_quality = 90;   // JPEG 质量 1-100，100 为最高质量
+    std::string jpeg_backend = "ffmpeg";  // JPEG 编码后端: ffmpeg/turbojpeg/auto
+    int write_threads = 2;   // 文件写入线程数，网络存储上可适当增大以掩盖打开/关闭文件的延迟
+    int write_batch = 16;    // 写入线程每次从队列取出的最大数据包数
+
+    // 输出格式(见 OutputFormat)，原始格式可以再经过 lz4/zstd 压缩
+    std::string output_format = "jpeg";
+    std::string output_compression = "none";
+    int compression_level = 1;  // zstd 压缩级别，或 lz4 的加速因子
+
+    // 输出方式: 每帧一个文件，或每路视频流一个打包文件(见 PackWriter)
+    bool pack_output = false;
+    bool discard_output = false;    // 编码后直接丢弃，不写入任何输出(用于基准测试)
+
+    // 库接口: packet_sink 不为空时编码结果交给它而不是写入文件，不创建输出目录，也不做断点续传
+    // 可能在多个写入线程中并发调用；数据包只在调用期间有效，返回 false 表示该帧输出失败
+    std::function<bool(const AVPacket* packet, int64_t timestamp)> packet_sink;
+
+    // 探测缓存目录(见 ProbeInfo)，为空时每次完整探测
+    std::string probe_cache_dir;
+
+    // 内存预算(见 MemoryBudget): 不为空时流水线入口等待预算，所有摄像头共享同一个预算
+    MemoryBudget* memory_budget = nullptr;
+
+    // 共享内存发布(见 SharedFramePublisher): 不为空时每路视频流的编码结果发布到
+    // 名为 <shm_name>_<摄像头> 的环形缓冲区，共 shm_slots 个槽位，每个槽位最多 shm_slot_size 字节
+    // shm_slot_size 不大于 0 时按视频尺寸和输出格式取单帧上限(见 max_published_frame_size)
+    std::string shm_name;
+    int shm_slots = 32;
+    int shm_slot_size = 0;
+    int pack_flush_interval = 100;  // 打包模式下每多少帧刷盘一次
+
+    // 断点续传: 跳过已存在且完整的输出，只生成缺失或损坏的帧
+    bool resume = false;
+
+    // FFmpeg 内部线程: 解码器线程数(0 表示按 CPU 预算自动分配)及线程类型 frame/slice/auto，
+    // 每个 JPEG 编码器上下文的切片线程数
+    int decode_threads = 0;
+    std::string decode_thread_type = "auto";
+    int jpeg_threads = 1;
+
+    // 单路视频按关键帧切分后并行解码的工作线程数(见 decode_keyframe_segments)，1 表示顺序解码
+    int segment_workers = 1;
+
+    // 单路视频的解码错误(数据包损坏等)达到该数量时放弃这一路，0 表示不限制
+    int max_decode_errors = 0;
+
+    // 硬件解码: vaapi/cuda/qsv/d3d11va 等设备类型或 auto，为空时使用软件解码
+    std::string hwaccel;
+    std::string hwaccel_device;  // 设备路径或编号，为空时使用默认设备
+    bool hwaccel_map = false;    // 尝试零拷贝映射硬件帧而不是拷贝
+
+    // 选择性提取: 只输出列表中的时间戳或 [select_begin_ms, select_end_ms] 范围内的帧
+    std::vector<int64_t> select_timestamps;
+    int64_t select_begin_ms = -1;
+    int64_t select_end_ms = -1;
+
+    // 抽帧: 每 sample_every 个索引条目取一个，或按 sample_fps 帧率取样(大于 0 时)；两者以整个索引为基准
+    // keyframes_only 时解码器丢弃非关键帧(AVDISCARD_NONKEY)，只输出关键帧
+    int sample_every = 1;
+    double sample_fps = 0.0;
+    bool keyframes_only = false;
+
+    // 帧 PTS 与索引时间戳匹配的最大误差(毫秒)，小于 0 表示取半个帧间隔
+    int64_t match_tolerance_ms = -1;
+
+    // 静止画面去重(见 FrameDeduplicator): 大于 0 时与上一个保留帧的亮度签名平均差低于该值的帧不编码，
+    // 重复帧时间戳记录到 <输出目录>/duplicates.txt
+    double dedupe_threshold = 0.0;
+
+    // 几何处理: calibration_dir 不为空时按 <目录>/<视频文件名>.calib 中的标定参数去畸变(见 FisheyeRemapper)，
+    // output_width/output_height 大于 0 时输出缩放到该尺寸；remap_threads 为每路去畸变的线程数
+    std::string calibration_dir;
+    int output_width = 0;
+    int output_height = 0;
+    int remap_threads = 2;
+
+    // 感兴趣区域裁剪(去畸变之后、缩放之前，只移动平面指针不复制)，crop_width 为 0 表示不裁剪
+    int crop_x = 0;
+    int crop_y = 0;
+    int crop_width = 0;
+    int crop_height = 0;
+
+    // 多个输出配置(见 OutputProfile)，为空时只输出一份到输出目录
+    std::vector<OutputProfile> profiles;
+
+    // 环视同步分组(见 process_camera_group): none/record/mosaic，及组内各路时间戳的最大差值(毫秒)
+    std::string group_mode = "none";
+    int64_t group_tolerance_ms = 16;
+
+    bool selective() const {
+        return !select_timestamps.empty() || select_begin_ms >= 0 || select_end_ms >= 0 ||
+               sample_every > 1 || sample_fps > 0.0;
+    }
+};
+
+// 解析 "WxH" 或 "WxH+X+Y"，后者的偏移可省略
+static bool parse_geometry(const std::string& text, int& width, int& height, int* x = nullptr, int* y = nullptr) {
+    int values[4] = {0, 0, 0, 0};
+    int n = std::sscanf(text.c_str(), "%dx%d+%d+%d", &values[0], &values[1], &values[2], &values[3]);
+    if (n < 2 || values[0] <= 0 || values[1] <= 0 || values[2] < 0 || values[3] < 0 || (!x && n > 2)) {
+        return false;
+    }
+    width = values[0];
+    height = values[1];
+    if (x) {
+        *x = values[2];
+        *y = values[3];
+    }
+    return true;
+}
+
+// 解析输出配置 "NAME:key=value,..."，key 为 crop=WxH+X+Y、size=WxH、format=FMT、quality=Q
+// 裁剪偏移取偶数，使 4:2:0 色度平面的指针与亮度对齐
+bool parse_output_profile(const std::string& spec, OutputProfile& profile) {
+    size_t colon = spec.find(':');
+    profile = OutputProfile();
+    profile.name = spec.substr(0, colon);
+    if (profile.name.empty() || profile.name.find_first_of("/\\") != std::string::npos) {
+        std::cerr << "无效的输出配置名称: " << spec << std::endl;
+        return false;
+    }
+    std::stringstream items(colon == std::string::npos ? std::string() : spec.substr(colon + 1));
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string value = eq == std::string::npos ? std::string() : item.substr(eq + 1);
+        bool ok = true;
+        if (key == "crop") {
+            ok = parse_geometry(value, profile.crop_width, profile.crop_height, &profile.crop_x, &profile.crop_y);
+            profile.crop_x &= ~1;
+            profile.crop_y &= ~1;
+        } else if (key == "size") {
+            ok = parse_geometry(value, profile.output_width, profile.output_height);
+        } else if (key == "format") {
+            profile.output_format = value;
+            const OutputFormatInfo* info = find_output_format(value);
+            ok = info && output_format_available(*info);
+        } else if (key == "quality") {
+            profile.jpeg_quality = std::atoi(value.c_str());
+            ok = profile.jpeg_quality >= 1 && profile.jpeg_quality <= 100;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "无效的输出配置项: " << item << " (" << profile.name << ")" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// 某个输出配置使用的提取参数
+ExtractOptions profile_options(const ExtractOptions& base, const OutputProfile& profile) {
+    ExtractOptions options = base;
+    options.profiles.clear();
+    if (profile.crop_width > 0) {
+        options.crop_x = profile.crop_x;
+        options.crop_y = profile.crop_y;
+        options.crop_width = profile.crop_width;
+        options.crop_height = profile.crop_height;
+    }
+    if (profile.output_width > 0) {
+        options.output_width = profile.output_width;
+        options.output_height = profile.output_height;
+    }
+    if (!profile.output_format.empty()) {
+        options.output_format = profile.output_format;
+    }
+    if (profile.jpeg_quality > 0) {
+        options.jpeg_quality = profile.jpeg_quality;
+    }
+    return options;
+}
+
+// 视频对应的标定文件: <calibration_dir>/<视频文件名去掉扩展名>.calib
+std::string calibration_path(const ExtractOptions& options, const std::string& video_path) {
+    return (fs::path(options.calibration_dir) / fs::path(video_path).stem()).string() + ".calib";
+}
+
+// 选项中的输出格式，名称无效时回退到 JPEG
+const OutputFormatInfo& selected_output_format(const ExtractOptions& options) {
+    const OutputFormatInfo* info = find_output_format(options.output_format);
+    return info ? *info : kOutputFormats[0];
+}
+
+// 每帧输出文件的扩展名，压缩时追加压缩格式的后缀
+std::string output_extension(const ExtractOptions& options) {
+    const OutputFormatInfo& info = selected_output_format(options);
+    std::string extension = info.extension;
+    if (is_raw_output_format(info.format)) {
+        extension += frame_compression_extension(options.output_compression);
+    }
+    return extension;
+}
+
+// 按输出格式创建编码器插件，原始格式和无损格式不会经过 JPEG 编码器
+std::unique_ptr<FrameEncoder> create_frame_encoder(const ExtractOptions& options) {
+    const OutputFormatInfo& info = selected_output_format(options);
+    if (info.format == OutputFormat::kJpeg) {
+        return create_jpeg_encoder(options.jpeg_backend, options.jpeg_quality,
+                                   std::max(1, options.jpeg_threads));
+    }
+    if (!is_raw_output_format(info.format)) {
+        return std::make_unique<LosslessImageEncoder>(info.format);
+    }
+
+    std::unique_ptr<FrameEncoder> encoder = std::make_unique<RawFrameEncoder>(info.pixel_format);
+#if defined(RESTORE_WITH_LZ4) || defined(RESTORE_WITH_ZSTD)
+    if (options.output_compression != "none") {
+        encoder = std::make_unique<CompressedFrameEncoder>(std::move(encoder), options.output_compression,
+                                                           options.compression_level);
+    }
+#endif
+    return encoder;
+}
+
+// 根据选择条件挑出需要提取的索引条目，返回按时间排序的条目下标
+// tolerance_ms 为列表时间戳与索引条目的最大差值，与解码帧匹配的误差相同(见 decode_video_to_images)
+std::vector<size_t> select_index_entries(const std::vector<int64_t>& timestamps,
+                                         const ExtractOptions& options, int64_t tolerance_ms) {
+    std::vector<size_t> selected;
+    if (timestamps.empty()) {
+        return selected;
+    }
+
+    // 只有抽帧条件时从全部条目中抽取
+    if (options.select_begin_ms >= 0 || options.select_end_ms >= 0 || options.select_timestamps.empty()) {
+        int64_t begin = options.select_begin_ms >= 0 ? options.select_begin_ms : INT64_MIN;
+        int64_t end = options.select_end_ms >= 0 ? options.select_end_ms : INT64_MAX;
+        for (size_t i = 0; i < timestamps.size(); i++) {
+            if (timestamps[i] >= begin && timestamps[i] <= end) {
+                selected.push_back(i);
+            }
+        }
+    }
+
+    // 列表中的每个时间戳取最接近的索引条目(索引文件按时间递增)，相差过大的忽略
+    for (int64_t wanted : options.select_timestamps) {
+        auto it = std::lower_bound(timestamps.begin(), timestamps.end(), wanted);
+        size_t best = it == timestamps.end() ? timestamps.size() - 1 : it - timestamps.begin();
+        if (best > 0 && wanted - timestamps[best - 1] < std::llabs(timestamps[best] - wanted)) {
+            best--;
+        }
+        if (std::llabs(timestamps[best] - wanted) <= tolerance_ms) {
+            selected.push_back(best);
+        } else {
+            std::cerr << "索引中没有接近 " << wanted << " 的时间戳" << std::endl;
+        }
+    }
+
+    std::sort(selected.begin(), selected.end(), [&](size_t a, size_t b) {
+        return timestamps[a] < timestamps[b];
+    });
+    selected.erase(std::unique(selected.begin(), selected.end()), selected.end());
+
+    // 抽帧按条目在整个索引中的序号和时间判断，按时间切分的任务之间不会错位或重复
+    // 按帧率抽取时每个 1/fps 时间槽取第一个条目
+    if (options.sample_every > 1 || options.sample_fps > 0.0) {
+        auto slot = [&](size_t i) {
+            return static_cast<int64_t>(std::floor((timestamps[i] - timestamps.front()) *
+                                                   options.sample_fps / 1000.0));
+        };
+        selected.erase(std::remove_if(selected.begin(), selected.end(), [&](size_t i) {
+            if (options.sample_every > 1 && i % options.sample_every != 0) {
+                return true;
+            }
+            return options.sample_fps > 0.0 && i > 0 && slot(i) == slot(i - 1);
+        }), selected.end());
+    }
+    return selected;
+}
+
+// 按时间戳将解码帧匹配到索引条目
+// 目标 PTS 按升序排列；正常情况下帧 PTS 单调递增，用游标顺序匹配，
+// PTS 回退时再用二分查找，每个目标最多匹配一次
+class TimestampMatcher {
+public:
+    TimestampMatcher(std::vector<int64_t> target_pts, int64_t tolerance)
+        : target_pts_(std::move(target_pts)),
+          matched_(target_pts_.size(), false),
+          tolerance_(tolerance) {}
+
+    // 返回与 pts 匹配的目标序号，没有匹配时返回 -1
+    long match(int64_t pts) {
+        // 游标之前已经错过的目标(流中缺帧)
+        while (cursor_ < target_pts_.size() && target_pts_[cursor_] + tolerance_ < pts) {
+            cursor_++;
+        }
+        if (cursor_ < target_pts_.size() && std::llabs(target_pts_[cursor_] - pts) <= tolerance_) {
+            return take(cursor_++);
+        }
+
+        // PTS 回退到游标之前
+        if (cursor_ > 0 && pts < target_pts_[cursor_ - 1] + tolerance_) {
+            auto it = std::lower_bound(target_pts_.begin(), target_pts_.begin() + cursor_,
+                                       pts - tolerance_);
+            for (; it != target_pts_.begin() + cursor_ && *it <= pts + tolerance_; ++it) {
+                size_t i = it - target_pts_.begin();
+                if (!matched_[i]) {
+                    return take(i);
+                }
+            }
+        }
+        return -1;
+    }
+
+    // 所有目标都已越过，后续帧不会再有匹配
+    bool done() const { return cursor_ >= target_pts_.size(); }
+
+    // 下一个尚未越过的目标 PTS
+    int64_t next_pts() const { return target_pts_[cursor_]; }
+
+    size_t matched_count() const { return matched_count_; }
+    size_t target_count() const { return target_pts_.size(); }
+
+private:
+    long take(size_t i) {
+        matched_[i] = true;
+        matched_count_++;
+        return static_cast<long>(i);
+    }
+
+    std::vector<int64_t> target_pts_;
+    std::vector<bool> matched_;
+    int64_t tolerance_;
+    size_t cursor_ = 0;
+    size_t matched_count_ = 0;
+};
+
+// 读取索引文件中的毫秒时间戳(每行一个)，按块读取并用 from_chars 解析，不为每行分配字符串
+// 空行和无法解析的行被忽略
+bool read_index_file(const std::string& path, std::vector<int64_t>& timestamps) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "无法打开索引文件: " << path << std::endl;
+        return false;
+    }
+    std::vector<char> buffer(1 << 16);
+    size_t carry = 0;  // 上一块末尾不完整的行，移到缓冲区开头
+    while (in) {
+        in.read(buffer.data() + carry, static_cast<std::streamsize>(buffer.size() - carry));
+        size_t size = carry + static_cast<size_t>(in.gcount());
+        const char* begin = buffer.data();
+        const char* end = begin + size;
+        // 文件未读完时只处理到最后一个换行符
+        const char* parse_end = end;
+        if (in) {
+            while (parse_end > begin && parse_end[-1] != '\n') {
+                parse_end--;
+            }
+            if (parse_end == begin) {
+                buffer.resize(buffer.size() * 2);  // 单行超过缓冲区
+                carry = size;
+                continue;
+            }
+        }
+        const char* p = begin;
+        while (p < parse_end) {
+            while (p < parse_end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+                p++;
+            }
+            if (p == parse_end) {
+                break;
+            }
+            int64_t value = 0;
+            auto result = std::from_chars(p, parse_end, value);
+            if (result.ec == std::errc()) {
+                timestamps.push_back(value);
+            }
+            p = static_cast<const char*>(memchr(result.ptr, '\n', parse_end - result.ptr));
+            p = p ? p + 1 : parse_end;
+        }
+        carry = static_cast<size_t>(end - parse_end);
+        memmove(buffer.data(), parse_end, carry);
+    }
+    return true;
+}
+
+// 在可复用的缓冲区中生成 <prefix><timestamp><extension> 形式的输出路径，
+// 缓冲区容量足够后不再分配内存
+void format_frame_path(std::string& path, const std::string& prefix, int64_t timestamp,
+                       const std::string& extension) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), timestamp);
+    path.assign(prefix);
+    path.append(digits, result.ptr);
+    path.append(extension);
+}
+
+// 输出配置之前的共享阶段: 从硬件取回帧 -> 重复帧检测 -> 去畸变
+// 单一输出时由流水线的转换阶段调用；多个输出配置时由 ProfileFanout 在分发前对每帧只执行一次，
+// 重复帧记录写入每个输出目录的 duplicates.txt
+class FramePreprocessor {
+public:
+    // calibration 不为空时去畸变到 options 的输出尺寸；stats 须在预处理结束前保持有效
+    FramePreprocessor(const ExtractOptions& options, const std::vector<std::string>& output_dirs,
+                      StreamStats* stats, const FisheyeCalibration* calibration)
+        : stats_(stats), memory_budget_(options.memory_budget), hwaccel_map_(options.hwaccel_map) {
+        if (calibration) {
+            remapper_ = std::make_unique<FisheyeRemapper>(*calibration, options.output_width,
+                                                          options.output_height, options.remap_threads);
+        }
+        if (options.dedupe_threshold > 0.0) {
+            deduplicator_ = std::make_unique<FrameDeduplicator>(options.dedupe_threshold);
+            if (!options.packet_sink) {
+                for (const auto& dir : output_dirs) {
+                    duplicates_paths_.push_back(dir + "/duplicates.txt");
+                    duplicates_.emplace_back(duplicates_paths_.back(),
+                                             options.resume ? std::ios::app : std::ios::trunc);
+                    if (!duplicates_.back().is_open()) {
+                        std::cerr << "无法创建重复帧记录: " << duplicates_paths_.back() << std::endl;
+                    }
+                }
+            }
+        }
+    }
+
+    FramePreprocessor(const FramePreprocessor&) = delete;
+    FramePreprocessor& operator=(const FramePreprocessor&) = delete;
+
+    // 接管并释放输入帧，返回处理后的帧；keep_hw 为 true 且不需要去畸变或重复帧检测时
+    // 能直接做 GPU JPEG 编码的硬件帧留在设备上
+    // 重复帧被释放并返回 nullptr，同时 duplicate 置为 true；失败时返回 nullptr
+    AVFrame* process(AVFrame* frame, int64_t timestamp, bool keep_hw, bool& duplicate) {
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+        if (desc && (desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+            if (keep_hw && !remapper_ && !deduplicator_ && gpu_jpeg_encoder_name(frame)) {
+                return frame;
+            }
+            AVFrame* sw_frame = charged(download_hw_frame(frame, hwaccel_map_, download_pool_));
+            av_frame_free(&frame);
+            if (!sw_frame) {
+                return nullptr;
+            }
+            frame = sw_frame;
+        }
+
+        if (deduplicator_ && skip_duplicate(frame, timestamp)) {
+            av_frame_free(&frame);
+            duplicate = true;
+            return nullptr;
+        }
+
+        // 去畸变只处理 4:2:0，其他格式先转换
+        if (remapper_) {
+            if (frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_YUVJ420P) {
+                AVFrame* converted_frame = charged(remap_input_converter_.convert(frame));
+                av_frame_free(&frame);
+                if (!converted_frame) {
+                    return nullptr;
+                }
+                frame = converted_frame;
+            }
+            AVFrame* remapped_frame = charged(remapper_->remap(frame, remap_pool_));
+            av_frame_free(&frame);
+            frame = remapped_frame;
+        }
+        return frame;
+    }
+
+    // 关闭重复帧记录，返回是否全部写入成功
+    bool finish() {
+        bool ok = true;
+        for (size_t i = 0; i < duplicates_.size(); i++) {
+            if (!duplicates_[i].is_open()) {
+                continue;
+            }
+            duplicates_[i].close();
+            if (duplicates_[i].fail()) {
+                std::cerr << "写入重复帧记录失败: " << duplicates_paths_[i] << std::endl;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    // 去畸变和硬件下载帧缓冲池的峰值占用
+    void report_pool_usage(std::ostream& os) const {
+        if (remap_pool_.high_water() > 0) {
+            os << "去畸变帧池峰值: " << remap_pool_.high_water() << " 帧, "
+               << remap_pool_.high_water_bytes() / (1024 * 1024) << " MB" << std::endl;
+        }
+        if (download_pool_.high_water() > 0) {
+            os << "硬件下载帧池峰值: " << download_pool_.high_water() << " 帧, "
+               << download_pool_.high_water_bytes() / (1024 * 1024) << " MB" << std::endl;
+        }
+    }
+
+private:
+    // 与上一个保留帧重复的帧不再编码，记录到 duplicates.txt (每行 "重复帧时间戳 保留帧时间戳")
+    bool skip_duplicate(const AVFrame* frame, int64_t timestamp) {
+        if (!deduplicator_->duplicate(frame)) {
+            last_kept_timestamp_ = timestamp;
+            return false;
+        }
+        for (auto& duplicates : duplicates_) {
+            duplicates << timestamp << ' ' << last_kept_timestamp_ << '\n';
+        }
+        stats_->frames_deduplicated.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 这里分配的帧按自身大小记账，源帧释放后其令牌随之归还
+    AVFrame* charged(AVFrame* frame) {
+        if (frame && memory_budget_) {
+            memory_budget_->charge_frame(frame);
+        }
+        return frame;
+    }
+
+    StreamStats* stats_;
+    MemoryBudget* const memory_budget_;
+    const bool hwaccel_map_;
+    FramePool download_pool_;
+    std::unique_ptr<FisheyeRemapper> remapper_;
+    FrameConverter remap_input_converter_;
+    FramePool remap_pool_;
+    std::unique_ptr<FrameDeduplicator> deduplicator_;
+    std::vector<std::string> duplicates_paths_;
+    std::vector<std::ofstream> duplicates_;
+    int64_t last_kept_timestamp_ = 0;
+};
+
+// 单路视频流的处理流水线: 像素转换 -> 编码(线程池，按输出格式选择编码器插件) -> 文件写入
+// 解码线程通过 submit 送入帧，各阶段之间通过有界队列连接
+class StreamPipeline {
+public:
+    // 每帧输出到 output_dir/<时间戳><扩展名>；pack 不为空时编码结果改为追加到打包文件，索引条目标记为 pack_slot
+    // pack 和 stats 须在流水线结束前保持有效；calibration 不为空时在转换阶段去畸变
+    // converters 不为空时改用这个共享的转换器缓存(须在流水线结束前保持有效)；
+    // preprocess 为 false 时上游(ProfileFanout)已经完成取回硬件帧、去重和去畸变
+    StreamPipeline(const ExtractOptions& options, const std::string& output_dir, PackWriter* pack,
+                   StreamStats* stats, uint32_t pack_slot = 0,
+                   const FisheyeCalibration* calibration = nullptr,
+                   ConverterCache* converters = nullptr, bool preprocess = true)
+        : output_prefix_(output_dir + "/"),
+          extension_(output_extension(options)),
+          pack_(pack),
+          pack_slot_(pack_slot),
+          stats_(stats),
+          converters_(converters ? converters : &own_converters_),
+          convert_format_(selected_output_format(options).pixel_format),
+          output_width_(options.output_width),
+          output_height_(options.output_height),
+          gpu_encode_(selected_output_format(options).format == OutputFormat::kJpeg &&
+                      options.jpeg_backend == "gpu"),
+          output_format_(selected_output_format(options)),
+          make_encoder_([options] { return create_frame_encoder(options); }),
+          discard_output_(options.discard_output),
+          packet_sink_(options.packet_sink),
+          memory_budget_(options.memory_budget),
+          crop_x_(options.crop_x),
+          crop_y_(options.crop_y),
+          crop_width_(options.crop_width),
+          crop_height_(options.crop_height),
+          write_batch_(std::max(1, options.write_batch)),
+          synchronous_(options.queue_depth <= 0),
+          convert_queue_(options.queue_depth),
+          encode_queue_(options.queue_depth),
+          write_queue_(options.queue_depth) {
+        if (preprocess) {
+            preprocessor_ = std::make_unique<FramePreprocessor>(options, std::vector<std::string>{output_dir},
+                                                                stats, calibration);
+        }
+        if (synchronous_) {
+            sync_encoder_ = make_encoder_();
+            return;
+        }
+
+        convert_thread_ = std::thread(&StreamPipeline::convert_loop, this);
+        int encode_threads = std::max(1, options.encode_threads);
+        for (int i = 0; i < encode_threads; i++) {
+            encode_threads_.emplace_back(&StreamPipeline::encode_loop, this);
+        }
+        int write_threads = std::max(1, options.write_threads);
+        for (int i = 0; i < write_threads; i++) {
+            write_threads_.emplace_back(&StreamPipeline::write_loop, this);
+        }
+    }
+
+    ~StreamPipeline() { finish(); }
+
+    StreamPipeline(const StreamPipeline&) = delete;
+    StreamPipeline& operator=(const StreamPipeline&) = delete;
+
+    // 送入一帧，流水线接管 frame 的所有权；有内存预算时在这里等待，对解码形成反压
+    // (调用方已用 MemoryBudget::acquire_frame 记账的帧不再重复记账)
+    void submit(AVFrame* frame, int64_t timestamp) {
+        if (memory_budget_) {
+            memory_budget_->acquire_frame(frame);
+        }
+        if (synchronous_) {
+            // 同步模式: 各阶段依次在解码线程内执行
+            FrameTask task{frame, timestamp};
+            PacketTask out;
+            if (convert_task(task, sync_histograms_[kStageConvert]) &&
+                encode_task(*sync_encoder_, task, out, sync_histograms_[kStageEncode])) {
+                write_task(out, sync_path_, sync_histograms_[kStageWrite]);
+            }
+            return;
+        }
+
+        FrameTask task{frame, timestamp};
+        if (!convert_queue_.push(std::move(task))) {
+            av_frame_free(&frame);
+        }
+    }
+
+    // 等待所有已送入的帧处理完毕，返回整个流水线是否成功
+    bool finish() {
+        if (!finished_) {
+            finished_ = true;
+            if (!synchronous_) {
+                convert_queue_.close();
+                convert_thread_.join();
+                encode_queue_.close();
+                for (auto& t : encode_threads_) {
+                    t.join();
+                }
+                write_queue_.close();
+                for (auto& t : write_threads_) {
+                    t.join();
+                }
+                stats_->set_queue("convert", convert_queue_.stats());
+                stats_->set_queue("encode", encode_queue_.stats());
+                stats_->set_queue("write", write_queue_.stats());
+            } else {
+                for (int stage : {kStageConvert, kStageEncode, kStageWrite}) {
+                    stats_->merge(static_cast<Stage>(stage), sync_histograms_[stage]);
+                }
+            }
+            if (preprocessor_ && !preprocessor_->finish()) {
+                success_ = false;
+            }
+        }
+        return success_;
+    }
+
+    int saved_frames() const { return saved_frames_; }
+    int write_failures() const { return write_failures_; }
+
+    // 所有帧都可以作为硬件帧直接交给 GPU JPEG 编码器(不裁剪、不缩放)
+    bool encodes_hw_frames() const {
+        return gpu_encode_ && crop_width_ <= 0 && output_width_ <= 0 && output_height_ <= 0;
+    }
+
+    // 输出帧缓冲池的峰值占用(共享的转换器缓存由其所有者报告)
+    void report_pool_usage(std::ostream& os) const {
+        if (converters_ == &own_converters_) {
+            own_converters_.report_pool_usage(os);
+        }
+        if (preprocessor_) {
+            preprocessor_->report_pool_usage(os);
+        }
+    }
+
+private:
+    // 任务只带时间戳，输出路径在写入阶段生成
+    struct FrameTask {
+        AVFrame* frame = nullptr;
+        int64_t timestamp = 0;
+    };
+
+    struct PacketTask {
+        AVPacket* packet = nullptr;
+        int64_t timestamp = 0;
+    };
+
+    // 裁剪到感兴趣区域: 只移动平面指针并修改宽高，不复制像素；区域超出帧时截到帧内
+    bool crop_frame(AVFrame* frame) {
+        int x = std::min(crop_x_, frame->width);
+        int y = std::min(crop_y_, frame->height);
+        int width = std::min(crop_width_, frame->width - x);
+        int height = std::min(crop_height_, frame->height - y);
+        if (width <= 0 || height <= 0) {
+            std::cerr << "裁剪区域在帧外: " << frame->width << "x" << frame->height << std::endl;
+            return false;
+        }
+        frame->crop_left = x;
+        frame->crop_top = y;
+        frame->crop_right = frame->width - x - width;
+        frame->crop_bottom = frame->height - y - height;
+        int ret = av_frame_apply_cropping(frame, AV_FRAME_CROP_UNALIGNED);
+        if (ret < 0) {
+            std::cerr << "裁剪失败: " << av_err2str(ret) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // 该帧是否需要缩放到输出尺寸
+    bool resizes(const AVFrame* frame) const {
+        return (output_width_ > 0 && frame->width != output_width_) ||
+               (output_height_ > 0 && frame->height != output_height_);
+    }
+
+    // 将解码帧(或共享阶段处理后的帧)变为编码器可接受的帧(GPU 编码时可以是硬件帧)，接管并释放输入帧
+    // 重复帧被释放并返回 nullptr，同时 duplicate 置为 true
+    AVFrame* prepare_frame(AVFrame* frame, int64_t timestamp, bool& duplicate) {
+        if (preprocessor_) {
+            // GPU 编码且不需要裁剪或缩放时硬件帧可以留在设备上
+            bool keep_hw = gpu_encode_ && crop_width_ <= 0 && !resizes(frame);
+            frame = preprocessor_->process(frame, timestamp, keep_hw, duplicate);
+            if (!frame) {
+                return nullptr;
+            }
+        }
+        if (frame->hw_frames_ctx) {
+            return frame;
+        }
+
+        if (crop_width_ > 0 && !crop_frame(frame)) {
+            av_frame_free(&frame);
+            return nullptr;
+        }
+
+        // 只有编码器不能直接接受的格式或需要缩放时才需要转换
+        if (!output_format_accepts(output_format_, frame) || resizes(frame)) {
+            AVFrame* converted_frame = converters_->convert(frame, convert_format_, output_width_, output_height_);
+            if (converted_frame && memory_budget_) {
+                memory_budget_->charge_frame(converted_frame);
+            }
+            av_frame_free(&frame);
+            frame = converted_frame;
+        }
+        return frame;
+    }
+
+    // 转换一帧，失败或跳过重复帧时释放帧并返回 false
+    bool convert_task(FrameTask& task, LatencyHistogram& histogram) {
+        auto start = SteadyClock::now();
+        bool duplicate = false;
+        task.frame = prepare_frame(task.frame, task.timestamp, duplicate);
+        histogram.record(elapsed_ns(start));
+        if (duplicate) {
+            return false;
+        }
+        if (!task.frame) {
+            stats_->convert_errors.fetch_add(1, std::memory_order_relaxed);
+            success_ = false;
+            return false;
+        }
+        return true;
+    }
+
+    // 编码一帧，编码结果的引用转移到 out，避免复制数据；总是释放输入帧
+    bool encode_task(FrameEncoder& encoder, FrameTask& task, PacketTask& out,
+                     LatencyHistogram& histogram) {
+        auto start = SteadyClock::now();
+        AVPacket* pkt = encoder.encode(task.frame);
+        histogram.record(elapsed_ns(start));
+        av_frame_free(&task.frame);
+        if (!pkt) {
+            std::cerr << "编码帧失败: " << task.timestamp << std::endl;
+            stats_->encode_errors.fetch_add(1, std::memory_order_relaxed);
+            success_ = false;
+            return false;
+        }
+
+        out.packet = av_packet_alloc();
+        if (!out.packet) {
+            std::cerr << "无法分配数据包" << std::endl;
+            success_ = false;
+            return false;
+        }
+        av_packet_move_ref(out.packet, pkt);
+        if (memory_budget_) {
+            av_buffer_unref(&out.packet->opaque_ref);
+            out.packet->opaque_ref = memory_budget_->charge(static_cast<size_t>(out.packet->size));
+        }
+        out.timestamp = task.timestamp;
+        return true;
+    }
+
+    // 保存一帧的编码结果并释放数据包，path 为写入线程复用的路径缓冲区
+    void write_task(PacketTask& task, std::string& path, LatencyHistogram& histogram) {
+        auto start = SteadyClock::now();
+        bool ok = true;
+        if (packet_sink_) {
+            ok = discard_output_ || packet_sink_(task.packet, task.timestamp);
+        } else {
+            if (!pack_) {
+                format_frame_path(path, output_prefix_, task.timestamp, extension_);
+            }
+            ok = discard_output_ || save_packet(task.packet, task.timestamp, path, pack_, pack_slot_);
+        }
+        histogram.record(elapsed_ns(start));
+        if (!ok) {
+            std::cerr << "保存帧失败: " << (pack_ || packet_sink_ ? std::to_string(task.timestamp) : path) << std::endl;
+            success_ = false;
+            write_failures_++;
+            stats_->write_errors.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            saved_frames_++;
+            stats_->frames_written.fetch_add(1, std::memory_order_relaxed);
+            stats_->bytes_written.fetch_add(task.packet->size, std::memory_order_relaxed);
+        }
+        av_packet_free(&task.packet);
+    }
+
+    // 像素转换阶段(包括从硬件取回帧)
+    void convert_loop() {
+        LatencyHistogram histogram;
+        FrameTask task;
+        while (convert_queue_.pop(task)) {
+            if (!convert_task(task, histogram)) {
+                continue;
+            }
+            if (!encode_queue_.push(std::move(task))) {
+                av_frame_free(&task.frame);
+            }
+        }
+        stats_->merge(kStageConvert, histogram);
+    }
+
+    // JPEG 编码阶段，每个线程持有独立的编码器
+    void encode_loop() {
+        LatencyHistogram histogram;
+        std::unique_ptr<FrameEncoder> encoder = make_encoder_();
+        FrameTask task;
+        while (encode_queue_.pop(task)) {
+            PacketTask out;
+            if (!encode_task(*encoder, task, out, histogram)) {
+                av_packet_free(&out.packet);
+                continue;
+            }
+            if (!write_queue_.push(std::move(out))) {
+                av_packet_free(&out.packet);
+            }
+        }
+        stats_->merge(kStageEncode, histogram);
+    }
+
+    // 文件写入阶段: 成批取出数据包写入，数据包在写完前一直由写入线程持有
+    void write_loop() {
+        LatencyHistogram histogram;
+        std::vector<PacketTask> batch;
+        batch.reserve(write_batch_);
+        std::string path;
+        while (write_queue_.pop_batch(batch, write_batch_)) {
+            for (auto& task : batch) {
+                write_task(task, path, histogram);
+            }
+            batch.clear();
+        }
+        stats_->merge(kStageWrite, histogram);
+    }
+
+    const std::string output_prefix_;
+    const std::string extension_;
+    PackWriter* pack_;
+    const uint32_t pack_slot_;
+    StreamStats* stats_;
+
+    // 以下仅由转换阶段使用
+    std::unique_ptr<FramePreprocessor> preprocessor_;
+    ConverterCache own_converters_;
+    ConverterCache* const converters_;
+    const AVPixelFormat convert_format_;
+    const int output_width_;
+    const int output_height_;
+    const bool gpu_encode_;  // 硬件帧直接交给 GPU JPEG 编码器
+    const OutputFormatInfo& output_format_;
+
+    // 每个编码线程(或同步模式)各自创建一个编码器
+    const std::function<std::unique_ptr<FrameEncoder>()> make_encoder_;
+    const bool discard_output_;
+    const std::function<bool(const AVPacket*, int64_t)> packet_sink_;
+    MemoryBudget* const memory_budget_;
+    const int crop_x_;
+    const int crop_y_;
+    const int crop_width_;
+    const int crop_height_;
+    const size_t write_batch_;
+    const bool synchronous_;
+    std::unique_ptr<FrameEncoder> sync_encoder_;
+    std::string sync_path_;
+    LatencyHistogram sync_histograms_[kStageCount];
+
+    BoundedQueue<FrameTask> convert_queue_;
+    BoundedQueue<FrameTask> encode_queue_;
+    BoundedQueue<PacketTask> write_queue_;
+
+    std::thread convert_thread_;
+    std::vector<std::thread> encode_threads_;
+    std::vector<std::thread> write_threads_;
+
+    std::atomic<bool> success_{true};
+    std::atomic<int> saved_frames_{0};
+    std::atomic<int> write_failures_{0};
+    bool finished_ = false;
+};
+
+// 多个输出配置共用的前半段: 每帧只取回、去重和去畸变一次，再把结果的引用分发给各配置的流水线，
+// 像素数据不复制；queue_depth 大于 0 时共享阶段在单独的线程中运行
+// 去畸变按 options 的输出尺寸进行，各配置的流水线再缩放到自己的尺寸
+class ProfileFanout {
+public:
+    // pipelines 须以 preprocess = false 创建，并在 finish 之后才结束；重复帧记录写入每个 output_dirs
+    ProfileFanout(const ExtractOptions& options, std::vector<StreamPipeline*> pipelines,
+                  const std::vector<std::string>& output_dirs, StreamStats* stats,
+                  const FisheyeCalibration* calibration)
+        : pipelines_(std::move(pipelines)),
+          preprocessor_(options, output_dirs, stats, calibration),
+          stats_(stats),
+          synchronous_(options.queue_depth <= 0),
+          queue_(options.queue_depth) {
+        // 硬件帧只在所有配置都能直接做 GPU 编码时留在设备上
+        keep_hw_ = std::all_of(pipelines_.begin(), pipelines_.end(),
+                               [](const StreamPipeline* pipeline) { return pipeline->encodes_hw_frames(); });
+        if (!synchronous_) {
+            thread_ = std::thread(&ProfileFanout::loop, this);
+        }
+    }
+
+    ~ProfileFanout() { finish(); }
+
+    ProfileFanout(const ProfileFanout&) = delete;
+    ProfileFanout& operator=(const ProfileFanout&) = delete;
+
+    // 送入一帧并接管其所有权
+    void submit(AVFrame* frame, int64_t timestamp) {
+        if (synchronous_) {
+            dispatch(frame, timestamp, sync_histogram_);
+            return;
+        }
+        if (!queue_.push(Task{frame, timestamp})) {
+            av_frame_free(&frame);
+        }
+    }
+
+    // 等待所有帧分发完毕(之后再结束各配置的流水线)，返回共享阶段是否成功
+    bool finish() {
+        if (!finished_) {
+            finished_ = true;
+            if (!synchronous_) {
+                queue_.close();
+                thread_.join();
+                stats_->set_queue("fanout", queue_.stats());
+            } else {
+                stats_->merge(kStageConvert, sync_histogram_);
+            }
+            if (!preprocessor_.finish()) {
+                success_ = false;
+            }
+        }
+        return success_;
+    }
+
+    void report_pool_usage(std::ostream& os) const { preprocessor_.report_pool_usage(os); }
+
+private:
+    struct Task {
+        AVFrame* frame = nullptr;
+        int64_t timestamp = 0;
+    };
+
+    void dispatch(AVFrame* frame, int64_t timestamp, LatencyHistogram& histogram) {
+        auto start = SteadyClock::now();
+        bool duplicate = false;
+        frame = preprocessor_.process(frame, timestamp, keep_hw_, duplicate);
+        histogram.record(elapsed_ns(start));
+        if (!frame) {
+            if (!duplicate) {
+                stats_->convert_errors.fetch_add(1, std::memory_order_relaxed);
+                success_ = false;
+            }
+            return;
+        }
+        for (size_t i = 0; i + 1 < pipelines_.size(); i++) {
+            AVFrame* reference = av_frame_clone(frame);
+            if (!reference) {
+                std::cerr << "无法分配帧" << std::endl;
+                success_ = false;
+                continue;
+            }
+            pipelines_[i]->submit(reference, timestamp);
+        }
+        pipelines_.back()->submit(frame, timestamp);
+    }
+
+    void loop() {
+        LatencyHistogram histogram;
+        Task task;
+        while (queue_.pop(task)) {
+            dispatch(task.frame, task.timestamp, histogram);
+        }
+        stats_->merge(kStageConvert, histogram);
+    }
+
+    const std::vector<StreamPipeline*> pipelines_;
+    FramePreprocessor preprocessor_;
+    StreamStats* stats_;
+    bool keep_hw_ = false;
+    const bool synchronous_;
+    LatencyHistogram sync_histogram_;
+    BoundedQueue<Task> queue_;
+    std::thread thread_;
+    std::atomic<bool> success_{true};
+    bool finished_ = false;
+};
+
+// 硬件解码状态，生命周期覆盖解码器上下文
+struct HwDecoder {
+    AVBufferRef* device_ctx = nullptr;
+    AVPixelFormat pix_fmt = AV_PIX_FMT_NONE;
+
+    HwDecoder() = default;
+    HwDecoder(const HwDecoder&) = delete;
+    HwDecoder& operator=(const HwDecoder&) = delete;
+    ~HwDecoder() { av_buffer_unref(&device_ctx); }
+};
+
+// get_format 回调: 优先选择硬件像素格式，不可用时退回第一个软件格式
+static AVPixelFormat get_hw_format(AVCodecContext* ctx, const AVPixelFormat* pix_fmts) {
+    auto* hw = static_cast<HwDecoder*>(ctx->opaque);
+    for (const AVPixelFormat* p = pix_fmts; *p != AV_PIX_FMT_NONE; p++) {
+        if (*p == hw->pix_fmt) {
+            return *p;
+        }
+    }
+    std::cerr << "解码器不接受硬件像素格式，改用软件解码" << std::endl;
+    for (const AVPixelFormat* p = pix_fmts; *p != AV_PIX_FMT_NONE; p++) {
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(*p);
+        if (desc && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+            return *p;
+        }
+    }
+    return AV_PIX_FMT_NONE;
+}
+
+// 为解码器创建指定类型的硬件设备，成功时配置 codec_ctx 并返回 true
+static bool try_hw_device(AVCodecContext* codec_ctx, const AVCodec* codec,
+                          AVHWDeviceType type, const std::string& device, HwDecoder& hw) {
+    for (int i = 0;; i++) {
+        const AVCodecHWConfig* config = avcodec_get_hw_config(codec, i);
+        if (!config) {
+            return false;
+        }
+        if ((config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) &&
+            config->device_type == type) {
+            hw.pix_fmt = config->pix_fmt;
+            break;
+        }
+    }
+
+    int ret = av_hwdevice_ctx_create(&hw.device_ctx, type,
+                                     device.empty() ? nullptr : device.c_str(), nullptr, 0);
+    if (ret < 0) {
+        std::cerr << "无法创建硬件设备 " << av_hwdevice_get_type_name(type)
+                  << ": " << av_err2str(ret) << std::endl;
+        hw.pix_fmt = AV_PIX_FMT_NONE;
+        return false;
+    }
+
+    codec_ctx->hw_device_ctx = av_buffer_ref(hw.device_ctx);
+    codec_ctx->opaque = &hw;
+    codec_ctx->get_format = get_hw_format;
+    return true;
+}
+
+// 按选项配置硬件解码，失败时保持软件解码
+static void setup_hw_decoder(AVCodecContext* codec_ctx, const AVCodec* codec,
+                             const ExtractOptions& options, HwDecoder& hw) {
+    bool ok = false;
+    if (options.hwaccel == "auto") {
+        for (AVHWDeviceType type = av_hwdevice_iterate_types(AV_HWDEVICE_TYPE_NONE);
+             type != AV_HWDEVICE_TYPE_NONE && !ok;
+             type = av_hwdevice_iterate_types(type)) {
+            ok = try_hw_device(codec_ctx, codec, type, options.hwaccel_device, hw);
+        }
+    } else {
+        AVHWDeviceType type = av_hwdevice_find_type_by_name(options.hwaccel.c_str());
+        if (type == AV_HWDEVICE_TYPE_NONE) {
+            std::cerr << "不支持的硬件加速类型: " << options.hwaccel << std::endl;
+        } else {
+            ok = try_hw_device(codec_ctx, codec, type, options.hwaccel_device, hw);
+        }
+    }
+
+    if (!ok) {
+        std::cerr << "硬件解码不可用，使用软件解码" << std::endl;
+        return;
+    }
+
+    // 流水线队列中的帧会占用硬件表面，预留足够的额外表面
+    int held = std::max(1, options.queue_depth) + 2;
+    if (options.hwaccel_map || options.jpeg_backend == "gpu") {
+        held += std::max(1, options.queue_depth) + std::max(1, options.encode_threads);
+    }
+    codec_ctx->extra_hw_frames = held;
+    std::cout << "使用硬件解码: " << av_hwdevice_get_type_name(
+        reinterpret_cast<AVHWDeviceContext*>(hw.device_ctx->data)->type) << std::endl;
+}
+
+// 探测结果缓存: 完整探测(avformat_find_stream_info)得到的视频流参数和关键帧 PTS，
+// 以文件路径、大小和修改时间为键保存在 <probe_cache_dir>/<路径哈希>.probe 中
+// 命中时以很小的 probesize/analyzeduration 打开文件并跳过 avformat_find_stream_info；
+// 文件格式与标定文件相同，每行 "键 值..."
+struct ProbeInfo {
+    std::string path;
+    uintmax_t size = 0;
+    int64_t mtime = 0;
+    int stream_index = -1;
+    int codec_id = AV_CODEC_ID_NONE;
+    int width = 0;
+    int height = 0;
+    int format = AV_PIX_FMT_NONE;
+    int color_range = AVCOL_RANGE_UNSPECIFIED;
+    int color_space = AVCOL_SPC_UNSPECIFIED;
+    int color_primaries = AVCOL_PRI_UNSPECIFIED;
+    int color_trc = AVCOL_TRC_UNSPECIFIED;
+    int chroma_location = AVCHROMA_LOC_UNSPECIFIED;
+    int field_order = AV_FIELD_UNKNOWN;
+    AVRational sample_aspect_ratio{0, 1};
+    AVRational avg_frame_rate{0, 1};
+    AVRational r_frame_rate{0, 1};
+    int64_t start_time = AV_NOPTS_VALUE;
+    int64_t duration = AV_NOPTS_VALUE;
+    // 关键帧在容器索引中的时间戳 -> 实际 PTS (见 plan_keyframe_segments)
+    std::map<int64_t, int64_t> keyframe_pts;
+};
+
+static std::string probe_cache_path(const std::string& cache_dir, const std::string& video_path) {
+    std::string absolute = fs::absolute(video_path).string();
+    std::ostringstream name;
+    name << std::hex << std::hash<std::string>()(absolute) << ".probe";
+    return (fs::path(cache_dir) / name.str()).string();
+}
+
+// 视频文件的缓存键: 绝对路径、大小和修改时间
+static bool probe_file_identity(const std::string& video_path, ProbeInfo& info) {
+    std::error_code ec;
+    info.path = fs::absolute(video_path, ec).string();
+    info.size = fs::file_size(video_path, ec);
+    if (ec) {
+        return false;
+    }
+    info.mtime = static_cast<int64_t>(fs::last_write_time(video_path, ec).time_since_epoch().count());
+    return !ec;
+}
+
+// 读取缓存，文件已变化或缓存不完整时返回 false
+bool load_probe_info(const std::string& cache_dir, const std::string& video_path, ProbeInfo& info) {
+    ProbeInfo current;
+    if (!probe_file_identity(video_path, current)) {
+        return false;
+    }
+    std::ifstream in(probe_cache_path(cache_dir, video_path));
+    if (!in.is_open()) {
+        return false;
+    }
+    ProbeInfo cached;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        fields >> key;
+        if (key == "path") {
+            std::getline(fields >> std::ws, cached.path);
+        } else if (key == "size") {
+            fields >> cached.size;
+        } else if (key == "mtime") {
+            fields >> cached.mtime;
+        } else if (key == "stream") {
+            fields >> cached.stream_index;
+        } else if (key == "codec_id") {
+            fields >> cached.codec_id;
+        } else if (key == "size_px") {
+            fields >> cached.width >> cached.height;
+        } else if (key == "format") {
+            fields >> cached.format;
+        } else if (key == "color") {
+            fields >> cached.color_range >> cached.color_space >> cached.color_primaries >> cached.color_trc
+                   >> cached.chroma_location;
+        } else if (key == "field_order") {
+            fields >> cached.field_order;
+        } else if (key == "sample_aspect_ratio") {
+            fields >> cached.sample_aspect_ratio.num >> cached.sample_aspect_ratio.den;
+        } else if (key == "avg_frame_rate") {
+            fields >> cached.avg_frame_rate.num >> cached.avg_frame_rate.den;
+        } else if (key == "r_frame_rate") {
+            fields >> cached.r_frame_rate.num >> cached.r_frame_rate.den;
+        } else if (key == "start_time") {
+            fields >> cached.start_time;
+        } else if (key == "duration") {
+            fields >> cached.duration;
+        } else if (key == "keyframe") {
+            int64_t ts = 0;
+            int64_t pts = 0;
+            if (fields >> ts >> pts) {
+                cached.keyframe_pts[ts] = pts;
+            }
+        }
+    }
+    if (cached.path != current.path || cached.size != current.size || cached.mtime != current.mtime ||
+        cached.stream_index < 0 || cached.codec_id == AV_CODEC_ID_NONE || cached.format == AV_PIX_FMT_NONE) {
+        return false;
+    }
+    info = std::move(cached);
+    return true;
+}
+
+// 写入缓存(先写临时文件再改名，并发运行的批处理任务不会读到半个文件)
+bool save_probe_info(const std::string& cache_dir, const std::string& video_path, const ProbeInfo& info) {
+    std::error_code ec;
+    fs::create_directories(cache_dir, ec);
+    std::string path = probe_cache_path(cache_dir, video_path);
+    std::string tmp_path = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        out << "path " << info.path << "\n"
+            << "size " << info.size << "\n"
+            << "mtime " << info.mtime << "\n"
+            << "stream " << info.stream_index << "\n"
+            << "codec_id " << info.codec_id << "\n"
+            << "size_px " << info.width << " " << info.height << "\n"
+            << "format " << info.format << "\n"
+            << "color " << info.color_range << " " << info.color_space << " " << info.color_primaries << " "
+            << info.color_trc << " " << info.chroma_location << "\n"
+            << "field_order " << info.field_order << "\n"
+            << "sample_aspect_ratio " << info.sample_aspect_ratio.num << " " << info.sample_aspect_ratio.den << "\n"
+            << "avg_frame_rate " << info.avg_frame_rate.num << " " << info.avg_frame_rate.den << "\n"
+            << "r_frame_rate " << info.r_frame_rate.num << " " << info.r_frame_rate.den << "\n"
+            << "start_time " << info.start_time << "\n"
+            << "duration " << info.duration << "\n";
+        for (const auto& keyframe : info.keyframe_pts) {
+            out << "keyframe " << keyframe.first << " " << keyframe.second << "\n";
+        }
+        if (!out) {
+            std::cerr << "无法写入探测缓存: " << tmp_path << std::endl;
+            fs::remove(tmp_path, ec);
+            return false;
+        }
+    }
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cerr << "无法写入探测缓存: " << path << std::endl;
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+// 从完整探测后的流中记录参数
+static void capture_probe_info(const std::string& video_path, AVFormatContext* format_ctx, int stream_index,
+                               ProbeInfo& info) {
+    AVStream* stream = format_ctx->streams[stream_index];
+    const AVCodecParameters* par = stream->codecpar;
+    probe_file_identity(video_path, info);
+    info.stream_index = stream_index;
+    info.codec_id = par->codec_id;
+    info.width = par->width;
+    info.height = par->height;
+    info.format = par->format;
+    info.color_range = par->color_range;
+    info.color_space = par->color_space;
+    info.color_primaries = par->color_primaries;
+    info.color_trc = par->color_trc;
+    info.chroma_location = par->chroma_location;
+    info.field_order = par->field_order;
+    info.sample_aspect_ratio = par->sample_aspect_ratio;
+    info.avg_frame_rate = stream->avg_frame_rate;
+    info.r_frame_rate = stream->r_frame_rate;
+    info.start_time = stream->start_time;
+    info.duration = format_ctx->duration;
+}
+
+// 把缓存的参数补到只读取了文件头的流上；容器头中的编码参数(如 extradata)与缓存不一致时返回 false
+static bool apply_probe_info(const ProbeInfo& info, AVFormatContext* format_ctx) {
+    if (info.stream_index >= static_cast<int>(format_ctx->nb_streams)) {
+        return false;
+    }
+    AVStream* stream = format_ctx->streams[info.stream_index];
+    AVCodecParameters* par = stream->codecpar;
+    if (par->codec_type != AVMEDIA_TYPE_VIDEO || par->codec_id != info.codec_id ||
+        (par->width && par->width != info.width) || (par->height && par->height != info.height)) {
+        return false;
+    }
+    par->width = info.width;
+    par->height = info.height;
+    par->format = info.format;
+    par->color_range = static_cast<AVColorRange>(info.color_range);
+    par->color_space = static_cast<AVColorSpace>(info.color_space);
+    par->color_primaries = static_cast<AVColorPrimaries>(info.color_primaries);
+    par->color_trc = static_cast<AVColorTransferCharacteristic>(info.color_trc);
+    par->chroma_location = static_cast<AVChromaLocation>(info.chroma_location);
+    par->field_order = static_cast<AVFieldOrder>(info.field_order);
+    par->sample_aspect_ratio = info.sample_aspect_ratio;
+    stream->avg_frame_rate = info.avg_frame_rate;
+    stream->r_frame_rate = info.r_frame_rate;
+    if (stream->start_time == AV_NOPTS_VALUE) {
+        stream->start_time = info.start_time;
+    }
+    if (format_ctx->duration == AV_NOPTS_VALUE) {
+        format_ctx->duration = info.duration;
+    }
+    return true;
+}
+
+// 打开视频文件、查找视频流并按选项创建解码器(含硬件解码和线程配置)
+// probe 不为空时(探测缓存命中)以有限探测打开并跳过 avformat_find_stream_info，缓存与文件不符时退回完整探测
+// 失败时已释放打开的资源；成功时由调用方释放 format_ctx 和 codec_ctx，hw 需比 codec_ctx 存活更久
+static bool open_video_decoder(const std::string& video_path, const ExtractOptions& options,
+                               const ProbeInfo* probe,
+                               AVFormatContext*& format_ctx, AVCodecContext*& codec_ctx,
+                               int& video_stream_index, HwDecoder& hw) {
+    // 打开视频文件
+    AVDictionary* format_options = nullptr;
+    if (probe) {
+        av_dict_set(&format_options, "probesize", "32768", 0);
+        av_dict_set(&format_options, "analyzeduration", "0", 0);
+    }
+    int ret = avformat_open_input(&format_ctx, video_path.c_str(), nullptr, &format_options);
+    av_dict_free(&format_options);
+    if (ret != 0) {
+        std::cerr << "无法打开视频文件: " << video_path << std::endl;
+        std::cerr << "错误代码: " << av_err2str(ret) << std::endl;
+        return false;
+    }
+
+    // 缓存与文件头不符时按无缓存重新打开
+    if (probe && !apply_probe_info(*probe, format_ctx)) {
+        avformat_close_input(&format_ctx);
+        return open_video_decoder(video_path, options, nullptr, format_ctx, codec_ctx, video_stream_index, hw);
+    }
+
+    // 获取流信息
+    if (!probe && avformat_find_stream_info(format_ctx, nullptr) < 0) {
+        std::cerr << "无法获取流信息" << std::endl;
+        avformat_close_input(&format_ctx);
+        return false;
+    }
+
+    // 查找视频流
+    video_stream_index = -1;
+    AVCodecParameters* codec_params = nullptr;
+    const AVCodec* codec = nullptr;
+    
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+        if (format_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            video_stream_index = i;
+            codec_params = format_ctx->streams[i]->codecpar;
+            codec = avcodec_find_decoder(codec_params->codec_id);
+            break;
+        }
+    }
+    
+    if (video_stream_index == -1 || !codec) {
+        std::cerr << "未找到视频流或解码器" << std::endl;
+        avformat_close_input(&format_ctx);
+        return false;
+    }
+
+    // 创建解码器上下文
+    codec_ctx = avcodec_alloc_context3(codec);
+    if (!codec_ctx) {
+        std::cerr << "无法分配解码器上下文" << std::endl;
+        avformat_close_input(&format_ctx);
+        return false;
+    }
+
+    // 复制编解码器参数到上下文
+    if (avcodec_parameters_to_context(codec_ctx, codec_params) < 0) {
+        std::cerr << "无法复制编解码器参数" << std::endl;
+        avcodec_free_context(&codec_ctx);
+        avformat_close_input(&format_ctx);
+        return false;
+    }
+
+    // 未指定硬件加速时强制使用软件解码
+    codec_ctx->hw_device_ctx = nullptr;
+    codec_ctx->get_format = nullptr; // 禁用硬件加速回调
+    if (!options.hwaccel.empty()) {
+        setup_hw_decoder(codec_ctx, codec, options, hw);
+    }
+
+    // 解码器线程配置
+    codec_ctx->thread_count = options.decode_threads;
+    if (options.decode_thread_type == "frame") {
+        codec_ctx->thread_type = FF_THREAD_FRAME;
+    } else if (options.decode_thread_type == "slice") {
+        codec_ctx->thread_type = FF_THREAD_SLICE;
+    } else {
+        codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    }
+
+    // 只要关键帧时解复用器和解码器都丢弃非关键帧，这些帧不会被解码
+    if (options.keyframes_only) {
+        format_ctx->streams[video_stream_index]->discard = AVDISCARD_NONKEY;
+        codec_ctx->skip_frame = AVDISCARD_NONKEY;
+    }
+
+    // 打开解码器
+    if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
+        std::cerr << "无法打开解码器" << std::endl;
+        avcodec_free_context(&codec_ctx);
+        avformat_close_input(&format_ctx);
+        return false;
+    }
+    return true;
+}
+
+// 关键帧并行解码的一段: 从 seek_ts 处的关键帧开始解码，负责 [begin_pts, end_pts) 内的帧
+// 目标条目按 PTS 分配到各段([begin_pts - 容差, end_pts - 容差))，每个条目只属于一段，输出与顺序解码一致
+struct KeyframeSegment {
+    int64_t seek_ts = 0;    // 起始关键帧在容器索引中的时间戳(传给 av_seek_frame)
+    int64_t begin_pts = 0;  // 起始关键帧的 PTS，第一段为 INT64_MIN
+    int64_t end_pts = 0;    // 下一段起始关键帧的 PTS，最后一段为 INT64_MAX
+    size_t first_target = 0;
+    size_t target_count = 0;
+};
+
+// 按容器索引中的关键帧把目标切分为约 count 段，各段的目标数大致相等
+// 段边界取关键帧的真实 PTS(读取一次关键帧数据包得到，mp4 索引中记录的是 DTS)
+// known_pts 中已有的关键帧(来自探测缓存)不再读取，新读取的关键帧 PTS 也记入其中
+// 会移动 format_ctx 的读取位置；没有关键帧索引或目标太少时返回空
+static std::vector<KeyframeSegment> plan_keyframe_segments(AVFormatContext* format_ctx, int stream_index,
+                                                           const std::vector<int64_t>& target_pts,
+                                                           int64_t tolerance, size_t count,
+                                                           std::map<int64_t, int64_t>& known_pts) {
+    std::vector<KeyframeSegment> segments;
+    AVStream* stream = format_ctx->streams[stream_index];
+    int entries = avformat_index_get_entries_count(stream);
+    count = std::min(count, target_pts.size());
+    if (entries <= 1 || count <= 1) {
+        return segments;
+    }
+    const AVIndexEntry* first = avformat_index_get_entry(stream, 0);
+
+    // 取每段第一个目标之前最近的关键帧作为段起点
+    std::vector<int64_t> keyframes;
+    for (size_t i = 1; i < count; i++) {
+        const AVIndexEntry* keyframe = avformat_index_get_entry_from_timestamp(
+            stream, target_pts[i * target_pts.size() / count], AVSEEK_FLAG_BACKWARD);
+        if (keyframe && (keyframe->flags & AVINDEX_KEYFRAME) && keyframe->timestamp > first->timestamp) {
+            keyframes.push_back(keyframe->timestamp);
+        }
+    }
+    std::sort(keyframes.begin(), keyframes.end());
+    keyframes.erase(std::unique(keyframes.begin(), keyframes.end()), keyframes.end());
+
+    // 读取各关键帧数据包的 PTS
+    AVPacket* packet = av_packet_alloc();
+    if (!packet) {
+        return segments;
+    }
+    std::vector<std::pair<int64_t, int64_t>> boundaries;  // (seek_ts, pts)
+    for (int64_t ts : keyframes) {
+        auto known = known_pts.find(ts);
+        if (known != known_pts.end()) {
+            if (boundaries.empty() || known->second > boundaries.back().second) {
+                boundaries.emplace_back(ts, known->second);
+            }
+            continue;
+        }
+        if (av_seek_frame(format_ctx, stream_index, ts, AVSEEK_FLAG_BACKWARD) < 0) {
+            continue;
+        }
+        while (av_read_frame(format_ctx, packet) >= 0) {
+            bool video = packet->stream_index == stream_index;
+            if (video && (packet->flags & AV_PKT_FLAG_KEY) && packet->pts != AV_NOPTS_VALUE) {
+                known_pts[ts] = packet->pts;
+                if (boundaries.empty() || packet->pts > boundaries.back().second) {
+                    boundaries.emplace_back(ts, packet->pts);
+                }
+            }
+            av_packet_unref(packet);
+            if (video) {
+                break;
+            }
+        }
+    }
+    av_packet_free(&packet);
+
+    // 按边界分配目标，跳过没有目标的段
+    KeyframeSegment segment;
+    segment.seek_ts = first->timestamp;
+    segment.begin_pts = INT64_MIN;
+    size_t cursor = 0;
+    for (size_t b = 0; b <= boundaries.size(); b++) {
+        segment.end_pts = b < boundaries.size() ? boundaries[b].second : INT64_MAX;
+        segment.first_target = cursor;
+        while (cursor < target_pts.size() &&
+               (b == boundaries.size() || target_pts[cursor] < segment.end_pts - tolerance)) {
+            cursor++;
+        }
+        segment.target_count = cursor - segment.first_target;
+        if (segment.target_count > 0) {
+            segments.push_back(segment);
+        }
+        if (b < boundaries.size()) {
+            segment.seek_ts = boundaries[b].first;
+            segment.begin_pts = boundaries[b].second;
+        }
+    }
+    if (segments.size() <= 1) {
+        segments.clear();
+    }
+    return segments;
+}
+
+// 记录一次解码错误，只打印前几条；达到 options.max_decode_errors 时记录失败原因并返回 false，调用方应停止解码
+static bool record_decode_error(const ExtractOptions& options, StreamStats* stats, const char* what, int err) {
+    constexpr uint64_t kPrintLimit = 10;
+    uint64_t errors = stats->decode_errors.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (errors <= kPrintLimit) {
+        std::cerr << what << ": " << av_err2str(err)
+                  << (errors == kPrintLimit ? " (后续解码错误不再打印)" : "") << std::endl;
+    }
+    if (options.max_decode_errors > 0 && errors >= static_cast<uint64_t>(options.max_decode_errors)) {
+        if (errors == static_cast<uint64_t>(options.max_decode_errors)) {
+            std::cerr << stats->camera << ": 解码错误达到上限 " << options.max_decode_errors
+                      << "，放弃这一路视频" << std::endl;
+        }
+        stats->fail("decode_errors");
+        return false;
+    }
+    return true;
+}
+
+// 多个工作线程各自打开视频和解码器(probe 不为空时跳过完整探测)，按顺序领取段并解码，
+// 匹配到的帧交给 submit (送入共享的流水线)
+// entries[i] 为 target_pts[i] 对应的索引条目；matched/unmatched 返回匹配和丢弃的帧数
+static bool decode_keyframe_segments(const std::string& video_path, const ExtractOptions& options,
+                                     const ProbeInfo* probe,
+                                     const std::vector<KeyframeSegment>& segments,
+                                     const std::vector<int64_t>& target_pts,
+                                     const std::vector<size_t>& entries,
+                                     const std::vector<int64_t>& timestamps, int64_t tolerance,
+                                     const std::function<void(AVFrame*, int64_t)>& submit,
+                                     StreamStats* stats,
+                                     size_t& matched, size_t& unmatched) {
+    std::atomic<size_t> next_segment{0};
+    std::atomic<size_t> matched_total{0};
+    std::atomic<size_t> unmatched_total{0};
+    std::atomic<bool> failed{false};
+    std::mutex submit_mutex;  // 同步模式的流水线只能由一个线程调用
+
+    auto worker = [&]() {
+        AVFormatContext* format_ctx = nullptr;
+        AVCodecContext* codec_ctx = nullptr;
+        int stream_index = -1;
+        HwDecoder hw;
+        if (!open_video_decoder(video_path, options, probe, format_ctx, codec_ctx, stream_index, hw)) {
+            failed = true;
+            return;
+        }
+        AVFrame* frame = av_frame_alloc();
+        AVPacket* packet = av_packet_alloc();
+        if (!frame || !packet) {
+            std::cerr << "无法分配帧或包" << std::endl;
+            failed = true;
+            av_frame_free(&frame);
+            av_packet_free(&packet);
+            avcodec_free_context(&codec_ctx);
+            avformat_close_input(&format_ctx);
+            return;
+        }
+
+        LatencyHistogram demux_histogram;
+        LatencyHistogram decode_histogram;
+        size_t index;
+        while (!failed && (index = next_segment.fetch_add(1)) < segments.size()) {
+            const KeyframeSegment& segment = segments[index];
+            if (av_seek_frame(format_ctx, stream_index, segment.seek_ts, AVSEEK_FLAG_BACKWARD) < 0) {
+                std::cerr << "跳转到关键帧失败: " << video_path << " @" << segment.seek_ts << std::endl;
+                failed = true;
+                break;
+            }
+            avcodec_flush_buffers(codec_ctx);
+
+            auto first = target_pts.begin() + segment.first_target;
+            TimestampMatcher matcher(std::vector<int64_t>(first, first + segment.target_count), tolerance);
+            bool past_end = false;
+
+            // 起始关键帧之前的帧(开放 GOP 的前导帧)属于上一段；越过段尾加容差后不再有匹配
+            auto handle_frame = [&]() {
+                stats->frames_decoded.fetch_add(1, std::memory_order_relaxed);
+                int64_t pts = frame->best_effort_timestamp;
+                long target = -1;
+                if (pts != AV_NOPTS_VALUE && pts >= segment.begin_pts) {
+                    if (segment.end_pts != INT64_MAX && pts >= segment.end_pts + tolerance) {
+                        past_end = true;
+                    } else {
+                        target = matcher.match(pts);
+                    }
+                }
+                if (target < 0) {
+                    av_frame_unref(frame);
+                    unmatched_total.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                AVFrame* task_frame = av_frame_alloc();
+                if (!task_frame) {
+                    std::cerr << "无法分配帧" << std::endl;
+                    av_frame_unref(frame);
+                    failed = true;
+                    return;
+                }
+                av_frame_move_ref(task_frame, frame);
+                matched_total.fetch_add(1, std::memory_order_relaxed);
+                std::lock_guard<std::mutex> lock(submit_mutex);
+                submit(task_frame, timestamps[entries[segment.first_target + target]]);
+            };
+
+            while (!matcher.done() && !past_end && !failed) {
+                auto demux_start = SteadyClock::now();
+                int ret = av_read_frame(format_ctx, packet);
+                demux_histogram.record(elapsed_ns(demux_start));
+                if (ret < 0) {
+                    // 文件结束，取出解码器中剩余的帧
+                    avcodec_send_packet(codec_ctx, nullptr);
+                    while (avcodec_receive_frame(codec_ctx, frame) >= 0) {
+                        handle_frame();
+                    }
+                    break;
+                }
+                if (packet->stream_index == stream_index) {
+                    auto decode_start = SteadyClock::now();
+                    ret = avcodec_send_packet(codec_ctx, packet);
+                    if (ret >= 0) {
+                        while ((ret = avcodec_receive_frame(codec_ctx, frame)) >= 0) {
+                            decode_histogram.record(elapsed_ns(decode_start));
+                            handle_frame();
+                            decode_start = SteadyClock::now();
+                        }
+                        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF &&
+                            !record_decode_error(options, stats, "接收帧失败", ret)) {
+                            failed = true;
+                        }
+                    } else if (!record_decode_error(options, stats, "送入数据包失败", ret)) {
+                        failed = true;
+                    }
+                }
+                av_packet_unref(packet);
+            }
+        }
+        stats->merge(kStageDemux, demux_histogram);
+        stats->merge(kStageDecode, decode_histogram);
+
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        avcodec_free_context(&codec_ctx);
+        avformat_close_input(&format_ctx);
+    };
+
+    size_t worker_count = std::min(segments.size(), static_cast<size_t>(options.segment_workers));
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < worker_count; i++) {
+        workers.emplace_back(worker);
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    matched = matched_total;
+    unmatched = unmatched_total;
+    return !failed;
+}
+
+// FFmpeg 的进程级初始化，批处理时可能有成千上万次 decode_video_to_images 调用，只需执行一次
+void init_ffmpeg_once() {
+    static std::once_flag once;
+    std::call_once(once, [] { avformat_network_init(); });
+}
+
+// 匹配到索引条目的解码帧的回调，接管 frame 的所有权；返回 false 表示停止解码
+using FrameHandler = std::function<bool(AVFrame* frame, int64_t timestamp)>;
+
+// 主解码函数
+// 提供 handler 时匹配到的帧交给 handler 而不是编码输出，此时不使用 output_dir，也不做断点续传；
+// options.packet_sink 不为空时编码结果交给它，同样不使用 output_dir
+bool decode_video_to_images(const std::string& video_path,
+                            const std::string& txt_path,
+                            const std::string& output_dir,
+                            const ExtractOptions& options = ExtractOptions(),
+                            StreamStats* stats = nullptr,
+                            const FrameHandler& handler = FrameHandler()) {
+    // 未提供统计对象时使用本地对象，热路径无需判断空指针
+    StreamStats local_stats;
+    if (!stats) {
+        stats = &local_stats;
+    }
+
+    // 确保输出目录存在
+    const bool writes_output = !handler && !options.packet_sink;
+    if (writes_output && !fs::exists(output_dir) && !fs::create_directories(output_dir)) {
+        std::cerr << "无法创建输出目录: " << output_dir << std::endl;
+        stats->fail("output");
+        return false;
+    }
+
+    // 检查索引文件是否存在
+    if (!fs::exists(txt_path)) {
+        std::cerr << "索引文件不存在: " << txt_path << std::endl;
+        stats->fail("index");
+        return false;
+    }
+
+    // 读取索引中的毫秒时间戳，输出文件以时间戳命名
+    std::vector<int64_t> timestamps;
+    if (!read_index_file(txt_path, timestamps)) {
+        stats->fail("index");
+        return false;
+    }
+
+    // 注册所有编解码器(整个进程只做一次)
+    init_ffmpeg_once();
+
+    // 检查视频文件是否存在
+    if (!fs::exists(video_path)) {
+        std::cerr << "视频文件不存在: " << video_path << std::endl;
+        stats->fail("video");
+        return false;
+    }
+
+    // 打开视频文件和解码器
+    AVFormatContext* format_ctx = nullptr;
+    AVCodecContext* codec_ctx = nullptr;
+    int video_stream_index = -1;
+    HwDecoder hw;
+    const bool probe_cache = !options.probe_cache_dir.empty();
+    ProbeInfo probe;
+    const bool probe_cached = probe_cache && load_probe_info(options.probe_cache_dir, video_path, probe);
+    if (!open_video_decoder(video_path, options, probe_cached ? &probe : nullptr, format_ctx, codec_ctx,
+                            video_stream_index, hw)) {
+        stats->fail("decoder");
+        return false;
+    }
+    const size_t cached_keyframes = probe.keyframe_pts.size();
+    if (probe_cache && !probe_cached) {
+        capture_probe_info(video_path, format_ctx, video_stream_index, probe);
+    }
+    std::cout << video_path << ": 解码线程 " << codec_ctx->thread_count << " ("
+              << (codec_ctx->active_thread_type == FF_THREAD_FRAME ? "frame" :
+                  codec_ctx->active_thread_type == FF_THREAD_SLICE ? "slice" : "none")
+              << ")" << std::endl;
+
+    // 创建帧和包
+    AVFrame* frame = av_frame_alloc();
+    AVPacket* packet = av_packet_alloc();
+    if (!frame || !packet) {
+        std::cerr << "无法分配帧或包" << std::endl;
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        avcodec_free_context(&codec_ctx);
+        avformat_close_input(&format_ctx);
+        return false;
+    }
+
+    bool success = true;
+
+    // 每个输出配置各有一条流水线(及打包文件)，输出到 <output_dir>/<配置名>；没有配置时只输出到 output_dir
+    // 转换、编码和写入在流水线线程中进行，解码线程只负责解复用和解码
+    // 多个配置时取回硬件帧、去重和去畸变由 ProfileFanout 对每帧只做一次，转换相同的配置共用转换器
+    ConverterCache shared_converters;
+    struct ProfileOutput {
+        ExtractOptions options;
+        std::string dir;
+        std::unique_ptr<PackWriter> pack;
+        std::unique_ptr<StreamPipeline> pipeline;
+    };
+    std::vector<ProfileOutput> outputs;
+    if (!handler) {
+        if (options.profiles.empty()) {
+            outputs.push_back(ProfileOutput{options, output_dir, nullptr, nullptr});
+        }
+        for (const OutputProfile& profile : options.profiles) {
+            outputs.push_back(ProfileOutput{profile_options(options, profile), output_dir + "/" + profile.name,
+                                            nullptr, nullptr});
+        }
+    }
+
+    FisheyeCalibration calibration;
+    const bool undistort = !handler && !options.calibration_dir.empty();
+    bool outputs_ready = !undistort || load_fisheye_calibration(calibration_path(options, video_path), calibration);
+    for (size_t i = 0; i < outputs.size() && outputs_ready; i++) {
+        ProfileOutput& output = outputs[i];
+        if (writes_output && !fs::exists(output.dir) && !fs::create_directories(output.dir)) {
+            std::cerr << "无法创建输出目录: " << output.dir << std::endl;
+            outputs_ready = false;
+            break;
+        }
+
+        // 打包输出模式
+        if (output.options.pack_output && writes_output) {
+            output.pack = std::make_unique<PackWriter>(output.dir, output.options.pack_flush_interval,
+                                                       selected_output_format(output.options).format);
+            if (!output.pack->open(output.options.resume)) {
+                outputs_ready = false;
+                break;
+            }
+        }
+
+        // 原始格式没有文件头，宽高只在这里记录
+        const OutputFormatInfo& output_format = selected_output_format(output.options);
+        if (is_raw_output_format(output_format.format)) {
+            std::cout << output.dir << ": 原始输出 " << output_format.name << " "
+                      << codec_ctx->width << "x" << codec_ctx->height;
+            if (output.options.output_compression != "none") {
+                std::cout << " (" << output.options.output_compression << " 压缩)";
+            }
+            std::cout << std::endl;
+        }
+
+        if (outputs.size() > 1) {
+            output.pipeline = std::make_unique<StreamPipeline>(output.options, output.dir, output.pack.get(),
+                                                               stats, 0, nullptr, &shared_converters, false);
+        } else {
+            output.pipeline = std::make_unique<StreamPipeline>(output.options, output.dir, output.pack.get(),
+                                                               stats, 0, undistort ? &calibration : nullptr);
+        }
+    }
+    if (!outputs_ready) {
+        stats->fail("output");
+        outputs.clear();
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        avcodec_free_context(&codec_ctx);
+        avformat_close_input(&format_ctx);
+        return false;
+    }
+    std::unique_ptr<ProfileFanout> fanout;
+    if (outputs.size() > 1) {
+        std::vector<StreamPipeline*> pipelines;
+        std::vector<std::string> dirs;
+        for (ProfileOutput& output : outputs) {
+            pipelines.push_back(output.pipeline.get());
+            dirs.push_back(output.dir);
+        }
+        fanout = std::make_unique<ProfileFanout>(options, std::move(pipelines), dirs, stats,
+                                                 undistort ? &calibration : nullptr);
+    }
+
+    // 把一帧送入所有输出配置的流水线(多个配置时经过 ProfileFanout，各配置得到帧的新引用，像素数据不复制)
+    // 内存预算在分发前记账一次，各引用共享同一个令牌
+    auto submit_outputs = [&](AVFrame* task_frame, int64_t timestamp) {
+        if (options.memory_budget) {
+            options.memory_budget->acquire_frame(task_frame);
+        }
+        if (fanout) {
+            fanout->submit(task_frame, timestamp);
+        } else {
+            outputs.back().pipeline->submit(task_frame, timestamp);
+        }
+    };
+
+    // 解码循环
+    bool stopped = false;  // handler 要求停止
+
+    // 将帧送入流水线(或交给 handler)
+    auto submit_entry = [&](AVFrame* decoded, size_t entry) {
+        AVFrame* task_frame = av_frame_alloc();
+        if (!task_frame) {
+            std::cerr << "无法分配帧" << std::endl;
+            av_frame_unref(decoded);
+            success = false;
+            return;
+        }
+        av_frame_move_ref(task_frame, decoded);
+        if (handler) {
+            stopped = !handler(task_frame, timestamps[entry]);
+            return;
+        }
+        submit_outputs(task_frame, timestamps[entry]);
+    };
+
+    // 将索引时间戳换算为流 PTS，索引首条时间戳对应视频流的起始时间
+    // 解码帧按 best_effort_timestamp 匹配最接近的索引条目，索引中的缺口不会使后续帧错位
+    AVStream* video_stream = format_ctx->streams[video_stream_index];
+    const bool selective = options.selective();
+
+    // 匹配误差: 指定 --match-tolerance 时使用该值，否则取半个帧间隔；选择条目时使用同一误差
+    int64_t pts_tolerance = 0;
+    if (options.match_tolerance_ms >= 0) {
+        pts_tolerance = av_rescale_q(options.match_tolerance_ms, AVRational{1, 1000},
+                                     video_stream->time_base);
+    } else {
+        AVRational frame_rate = video_stream->avg_frame_rate.num > 0
+                                    ? video_stream->avg_frame_rate : AVRational{30, 1};
+        pts_tolerance = av_rescale_q(1, AVRational{frame_rate.den, frame_rate.num * 2},
+                                     video_stream->time_base);
+    }
+    const int64_t tolerance_ms = options.match_tolerance_ms >= 0
+                                     ? options.match_tolerance_ms
+                                     : av_rescale_q_rnd(pts_tolerance, video_stream->time_base,
+                                                        AVRational{1, 1000}, AV_ROUND_UP);
+
+    // 选择性提取时只匹配选中的条目，之后按需跳转到目标之前最近的关键帧
+    std::vector<size_t> target_entries;
+    if (selective) {
+        target_entries = select_index_entries(timestamps, options, tolerance_ms);
+        std::cout << "选择性提取 " << target_entries.size() << " / "
+                  << timestamps.size() << " 帧" << std::endl;
+    } else {
+        target_entries.resize(timestamps.size());
+        for (size_t i = 0; i < target_entries.size(); i++) {
+            target_entries[i] = i;
+        }
+    }
+
+    // 断点续传时去掉已经完成的条目，之后同样按需跳转到第一个缺失的帧
+    const bool resume = options.resume && writes_output;
+    if (resume) {
+        // 条目在所有输出配置中都已完成才跳过；之前判定为重复而没有输出的帧也算已完成
+        struct ResumeState {
+            std::vector<int64_t> packed;
+            std::vector<int64_t> duplicates;
+            std::string prefix;
+            std::string extension;
+        };
+        std::vector<ResumeState> states(outputs.size());
+        for (size_t i = 0; i < outputs.size(); i++) {
+            if (outputs[i].pack) {
+                states[i].packed = outputs[i].pack->existing_timestamps();
+            }
+            if (options.dedupe_threshold > 0.0) {
+                states[i].duplicates = read_duplicate_timestamps(outputs[i].dir + "/duplicates.txt");
+            }
+            states[i].prefix = outputs[i].dir + "/";
+            states[i].extension = output_extension(outputs[i].options);
+        }
+        size_t before = target_entries.size();
+        std::string path;
+        auto completed = [&](size_t i, int64_t timestamp) {
+            const ResumeState& state = states[i];
+            if (std::binary_search(state.duplicates.begin(), state.duplicates.end(), timestamp)) {
+                return true;
+            }
+            if (outputs[i].pack) {
+                return std::binary_search(state.packed.begin(), state.packed.end(), timestamp);
+            }
+            format_frame_path(path, state.prefix, timestamp, state.extension);
+            return is_complete_output_file(path, selected_output_format(outputs[i].options).format);
+        };
+        target_entries.erase(
+            std::remove_if(target_entries.begin(), target_entries.end(), [&](size_t entry) {
+                for (size_t i = 0; i < outputs.size(); i++) {
+                    if (!completed(i, timestamps[entry])) {
+                        return false;
+                    }
+                }
+                return true;
+            }),
+            target_entries.end());
+        std::cout << "断点续传: 已完成 " << (before - target_entries.size())
+                  << " 帧，待处理 " << target_entries.size() << " 帧" << std::endl;
+    }
+    const bool seek_enabled = selective || resume;
+
+    int64_t start_pts = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+    std::vector<int64_t> target_pts;
+    target_pts.reserve(target_entries.size());
+    for (size_t entry : target_entries) {
+        target_pts.push_back(start_pts + av_rescale_q(timestamps[entry] - timestamps.front(),
+                                                      AVRational{1, 1000},
+                                                      video_stream->time_base));
+    }
+
+    // 按关键帧切分为多段并行解码，各段由独立的解复用器和解码器处理
+    std::vector<KeyframeSegment> segments;
+    // 去重需要按时间顺序比较相邻帧，此时不分段
+    if (options.segment_workers > 1 && !handler && options.dedupe_threshold <= 0.0) {
+        segments = plan_keyframe_segments(format_ctx, video_stream_index, target_pts, pts_tolerance,
+                                          static_cast<size_t>(options.segment_workers) * 4, probe.keyframe_pts);
+        if (segments.empty()) {
+            av_seek_frame(format_ctx, video_stream_index, start_pts, AVSEEK_FLAG_BACKWARD);
+        }
+    }
+    const bool segmented = !segments.empty();
+    if (probe_cache && (!probe_cached || probe.keyframe_pts.size() != cached_keyframes)) {
+        save_probe_info(options.probe_cache_dir, video_path, probe);
+    }
+    const size_t target_count = target_pts.size();
+    size_t segment_matched = 0;
+    size_t segment_unmatched = 0;
+    if (segmented) {
+        std::cout << video_path << ": 按关键帧切分为 " << segments.size() << " 段, "
+                  << std::min(segments.size(), static_cast<size_t>(options.segment_workers))
+                  << " 个解码线程并行解码" << std::endl;
+        if (!decode_keyframe_segments(video_path, options, probe_cache ? &probe : nullptr, segments,
+                                      target_pts, target_entries, timestamps, pts_tolerance,
+                                      submit_outputs, stats, segment_matched, segment_unmatched)) {
+            stats->fail("decode");
+            success = false;
+        }
+        target_pts.clear();
+    }
+    TimestampMatcher matcher(std::move(target_pts), pts_tolerance);
+
+    // 处理一个解码帧，未匹配到索引条目的帧在编码前丢弃
+    // 返回 false 表示不再需要后续帧
+    int64_t last_frame_pts = AV_NOPTS_VALUE;
+    int unmatched_frames = 0;
+    auto handle_frame = [&](AVFrame* decoded) {
+        int64_t pts = decoded->best_effort_timestamp;
+        long target = -1;
+        if (pts != AV_NOPTS_VALUE) {
+            last_frame_pts = pts;
+            target = matcher.match(pts);
+        }
+
+        if (target >= 0) {
+            submit_entry(decoded, target_entries[target]);
+        } else {
+            av_frame_unref(decoded);
+            unmatched_frames++;
+        }
+        return !stopped && !matcher.done();
+    };
+
+    // 若下一个目标之前的关键帧位于当前解码位置之后，则直接跳转过去
+    int64_t last_seek_pts = AV_NOPTS_VALUE;
+    auto seek_to_next_target = [&]() {
+        int64_t pts = matcher.next_pts();
+        int64_t keyframe_pts = pts;
+        const AVIndexEntry* keyframe = avformat_index_get_entry_from_timestamp(
+            video_stream, pts, AVSEEK_FLAG_BACKWARD);
+        if (keyframe) {
+            keyframe_pts = keyframe->timestamp;
+        }
+        bool ahead = last_frame_pts == AV_NOPTS_VALUE || keyframe_pts > last_frame_pts;
+        if (!ahead || (last_seek_pts != AV_NOPTS_VALUE && keyframe_pts <= last_seek_pts)) {
+            return;
+        }
+        if (av_seek_frame(format_ctx, video_stream_index, pts, AVSEEK_FLAG_BACKWARD) < 0) {
+            std::cerr << "跳转失败，继续顺序解码" << std::endl;
+            last_seek_pts = keyframe_pts;
+            return;
+        }
+        avcodec_flush_buffers(codec_ctx);
+        last_seek_pts = keyframe_pts;
+    };
+
+    // 解复用和解码阶段的计时
+    LatencyHistogram demux_histogram;
+    LatencyHistogram decode_histogram;
+
+    bool done = matcher.done();
+    bool aborted = false;  // 解码错误达到上限
+    int ret = 0;
+    while (!done) {
+        if (seek_enabled) {
+            seek_to_next_target();
+        }
+
+        auto demux_start = SteadyClock::now();
+        ret = av_read_frame(format_ctx, packet);
+        demux_histogram.record(elapsed_ns(demux_start));
+        if (ret < 0) {
+            break;
+        }
+
+        if (packet->stream_index == video_stream_index) {
+            // 检查解码器上下文和数据包是否有效
+            if (!codec_ctx || !packet) {
+                std::cerr << "无效的解码器上下文或数据包" << std::endl;
+                av_packet_unref(packet);
+                continue;
+            }
+            
+            // 发送数据包到解码器
+            auto decode_start = SteadyClock::now();
+            ret = avcodec_send_packet(codec_ctx, packet);
+            if (ret < 0) {
+                // 损坏的数据包跳过，错误太多时放弃这一路
+                av_packet_unref(packet);
+                if (!record_decode_error(options, stats, "送入数据包失败", ret)) {
+                    aborted = true;
+                    success = false;
+                    done = true;
+                }
+                continue;
+            }
+
+            // 接收解码后的帧
+            while (true) {
+                ret = avcodec_receive_frame(codec_ctx, frame);
+                decode_histogram.record(elapsed_ns(decode_start));
+                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+                    break;
+                } else if (ret < 0) {
+                    // 与送入失败相同: 错误达到上限时才放弃这一路(失败原因由 record_decode_error 记录)
+                    if (!record_decode_error(options, stats, "接收帧失败", ret)) {
+                        aborted = true;
+                        done = true;
+                        success = false;
+                    }
+                    break;
+                }
+                stats->frames_decoded.fetch_add(1, std::memory_order_relaxed);
+
+                bool more = handle_frame(frame);
+                decode_start = SteadyClock::now();
+                if (!more) {
+                    done = true;
+                    break;
+                }
+            }
+        }
+        
+        av_packet_unref(packet);
+    }
+
+    // 刷新解码器缓冲区(分段解码时各段已自行处理)
+    if (!segmented) {
+        avcodec_send_packet(codec_ctx, nullptr);
+        while (!aborted && avcodec_receive_frame(codec_ctx, frame) >= 0) {
+            // 处理剩余的帧（如果有）
+            stats->frames_decoded.fetch_add(1, std::memory_order_relaxed);
+            if (stopped) {
+                av_frame_unref(frame);
+                continue;
+            }
+            handle_frame(frame);
+        }
+        stats->merge(kStageDemux, demux_histogram);
+        stats->merge(kStageDecode, decode_histogram);
+    }
+
+    size_t matched_count = segmented ? segment_matched : matcher.matched_count();
+    if (segmented) {
+        unmatched_frames += static_cast<int>(segment_unmatched);
+    }
+    // 只要关键帧时大部分条目本来就没有对应的帧
+    if (!stopped && !options.keyframes_only && matched_count < target_count) {
+        std::cerr << "有 " << (target_count - matched_count) << " 个索引条目没有匹配的帧" << std::endl;
+    }
+    if (unmatched_frames > 0) {
+        std::cout << "跳过 " << unmatched_frames << " 个没有对应目标条目的帧" << std::endl;
+    }
+
+    // 等待流水线处理完所有帧(先等共享阶段分发完)
+    if (fanout) {
+        if (!fanout->finish()) {
+            stats->fail("output");
+            success = false;
+        }
+        fanout->report_pool_usage(std::cout);
+    }
+    for (ProfileOutput& output : outputs) {
+        if (!output.pipeline->finish()) {
+            stats->fail("output");
+            success = false;
+        }
+        output.pipeline->report_pool_usage(std::cout);
+        if (output.pipeline->write_failures() > 0) {
+            std::cerr << output.pipeline->write_failures() << " 个文件写入失败: " << output.dir << std::endl;
+        }
+        if (output.pack) {
+            if (!output.pack->close()) {
+                stats->fail("output");
+                success = false;
+            }
+            std::cout << "打包输出 " << output.pack->frame_count() << " 帧: " << output.dir << "/frames.pack"
+                      << std::endl;
+        }
+    }
+    if (fanout) {
+        shared_converters.report_pool_usage(std::cout);
+    }
+    if (!outputs.empty() && options.dedupe_threshold > 0.0) {
+        std::cout << "跳过 " << stats->frames_deduplicated << " 个重复帧: " << output_dir << std::endl;
+    }
+
+    // 清理资源
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&codec_ctx);
+    avformat_close_input(&format_ctx);
+    
+    return success;
+}
+
+// ---- 库接口 ----
+// 以 RESTORE_NO_MAIN 编译本文件即可在进程内使用(如 bench.cpp)；除 decode_video_to_images 的
+// handler 回调和 ExtractOptions::packet_sink 外，还提供下面的拉取式读取和共享内存发布
+
+// 拉取式读取解码帧: 后台线程解码，next() 按时间顺序逐帧返回匹配到索引条目的帧
+// 用法: FrameReader reader(video, index, options); while (reader.next(frame, ts)) { ...; av_frame_free(&frame); }
+class FrameReader {
+public:
+    // depth: 后台线程最多领先消费者的帧数
+    FrameReader(const std::string& video_path, const std::string& txt_path,
+                const ExtractOptions& options = ExtractOptions(), size_t depth = 8)
+        : queue_(depth) {
+        thread_ = std::thread([this, video_path, txt_path, options] {
+            success_ = decode_video_to_images(video_path, txt_path, std::string(), options, &stats_,
+                                              [this](AVFrame* frame, int64_t timestamp) {
+                DecodedFrame item{frame, timestamp};
+                if (!queue_.push(std::move(item))) {
+                    av_frame_free(&frame);
+                    return false;  // 消费者已经关闭
+                }
+                return true;
+            });
+            queue_.close();
+        });
+    }
+
+    // 提前关闭时丢弃尚未取走的帧
+    ~FrameReader() {
+        queue_.close();
+        DecodedFrame item;
+        while (queue_.pop(item)) {
+            av_frame_free(&item.frame);
+        }
+        thread_.join();
+        while (queue_.pop(item)) {
+            av_frame_free(&item.frame);
+        }
+    }
+
+    FrameReader(const FrameReader&) = delete;
+    FrameReader& operator=(const FrameReader&) = delete;
+
+    // 取下一帧，调用方接管 frame 的所有权；没有更多帧时返回 false
+    bool next(AVFrame*& frame, int64_t& timestamp) {
+        DecodedFrame item;
+        if (!queue_.pop(item)) {
+            return false;
+        }
+        frame = item.frame;
+        timestamp = item.timestamp;
+        return true;
+    }
+
+    // next() 返回 false 之后有效: 解码是否成功完成
+    bool success() const { return success_; }
+    StreamStats& stats() { return stats_; }
+
+private:
+    struct DecodedFrame {
+        AVFrame* frame = nullptr;
+        int64_t timestamp = 0;
+    };
+
+    BoundedQueue<DecodedFrame> queue_;
+    StreamStats stats_;
+    std::atomic<bool> success_{false};
+    std::thread thread_;
+};
+
+// ---- 共享内存发布 ----
+// 环形缓冲区布局: SharedRingHeader，之后是 slot_count 个槽位，每个槽位为 SharedSlotHeader 加 slot_size 字节数据
+// 两个头都填充到 64 字节，槽位起点和槽位中的帧数据都按 64 字节对齐，读取方可以直接做 SIMD 加载
+// 发布者从不等待消费者，环满时覆盖最旧的槽位。每个槽位用序号做顺序锁:
+// 写入第 n 帧时 seq 先置为 2n+1，数据写完后置为 2n+2；消费者直接在共享内存中读取数据(零拷贝)，
+// 读完后确认 seq 未变，变化说明读取期间被覆盖
+struct alignas(64) SharedRingHeader {
+    static constexpr uint32_t kMagic = 0x47525346;  // "FSRG"
+    static constexpr uint32_t kVersion = 2;         // 版本 2: 头填充到 64 字节
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    std::atomic<uint64_t> write_seq;  // 已发布的帧数
+    std::atomic<uint32_t> closed;     // 发布者结束后置 1
+    uint32_t reserved;
+};
+
+struct alignas(64) SharedSlotHeader {
+    std::atomic<uint64_t> seq;
+    int64_t timestamp;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(SharedRingHeader) == 64 && sizeof(SharedSlotHeader) == 64,
+              "共享内存头必须为 64 字节，帧数据才能按 64 字节对齐");
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "共享内存中的原子变量必须无锁");
+
+// 共享内存映射，POSIX 为 shm_open/mmap，Windows 为命名的页文件映射
+class SharedMemory {
+public:
+    SharedMemory() = default;
+    ~SharedMemory() { close(); }
+
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    // create 为 true 时创建(或重建)指定大小的区域，否则打开已有区域，size 为 0 时取实际大小
+    bool open(const std::string& name, size_t size, bool create) {
+        name_ = name;
+        owner_ = create;
+#ifdef _WIN32
+        if (create) {
+            handle_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                         static_cast<DWORD>(static_cast<uint64_t>(size) >> 32),
+                                         static_cast<DWORD>(size), name.c_str());
+        } else {
+            handle_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+        }
+        if (!handle_) {
+            return false;
+        }
+        data_ = MapViewOfFile(handle_, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (data_ && size == 0) {
+            MEMORY_BASIC_INFORMATION info;
+            if (VirtualQuery(data_, &info, sizeof(info))) {
+                size = info.RegionSize;
+            }
+        }
+#else
+        int fd = create ? shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600)
+                        : shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (create ? ftruncate(fd, static_cast<off_t>(size)) != 0
+                   : (fstat(fd, &st) != 0 || (size = static_cast<size_t>(st.st_size)) == 0)) {
+            ::close(fd);
+            return false;
+        }
+        data_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data_ == MAP_FAILED) {
+            data_ = nullptr;
+        }
+#endif
+        size_ = size;
+        return data_ != nullptr;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data_) {
+            UnmapViewOfFile(data_);
+        }
+        if (handle_) {
+            CloseHandle(handle_);
+            handle_ = nullptr;
+        }
+#else
+        if (data_) {
+            munmap(data_, size_);
+        }
+        if (owner_ && !name_.empty()) {
+            shm_unlink(name_.c_str());  // 已映射的消费者不受影响
+        }
+#endif
+        data_ = nullptr;
+        name_.clear();
+    }
+
+    uint8_t* data() const { return static_cast<uint8_t*>(data_); }
+    size_t size() const { return size_; }
+
+private:
+    std::string name_;
+    bool owner_ = false;
+    void* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    HANDLE handle_ = nullptr;
+#endif
+};
+
+// 槽位大小取 64 字节的整数倍，各槽位的起点(及其后的帧数据)保持 64 字节对齐，相邻槽位的序号也不共享缓存行
+static size_t shared_slot_stride(uint32_t slot_size) {
+    return (sizeof(SharedSlotHeader) + slot_size + 63) / 64 * 64;
+}
+
+// 发布到共享内存的单帧数据上限，width/height 为视频尺寸，裁剪和输出尺寸按 options 折算
+// 原始格式为输出帧大小(压缩时取压缩上限)；图像编码格式按每像素 4 字节加 64 KB 文件头，
+// 覆盖 JPEG/PNG/WebP 的最坏情况。共享内存按页按需分配，槽位中没有写到的部分不占物理内存
+static size_t max_published_frame_size(const ExtractOptions& options, int width, int height) {
+    if (options.crop_width > 0 && options.crop_height > 0) {
+        width = std::min(options.crop_width, width - std::min(options.crop_x, width));
+        height = std::min(options.crop_height, height - std::min(options.crop_y, height));
+    }
+    if (options.output_width > 0) {
+        width = options.output_width;
+    }
+    if (options.output_height > 0) {
+        height = options.output_height;
+    }
+    const OutputFormatInfo& format = selected_output_format(options);
+    if (is_raw_output_format(format.format)) {
+        int size = av_image_get_buffer_size(format.pixel_format, width, height, 1);
+        return size > 0 ? compressed_size_bound(options.output_compression, size) : 0;
+    }
+    return static_cast<size_t>(width) * static_cast<size_t>(height) * 4 + (64 << 10);
+}
+
+// 共享内存环形缓冲区的发布端，publish 可由多个写入线程并发调用
+class SharedFramePublisher {
+public:
+    SharedFramePublisher(std::string name, int slot_count, int slot_size)
+        : name_(std::move(name)),
+          slot_count_(static_cast<uint32_t>(std::max(1, slot_count))),
+          slot_size_(static_cast<uint32_t>(std::max(1, slot_size))) {}
+
+    ~SharedFramePublisher() {
+        if (header_) {
+            header_->closed.store(1, std::memory_order_release);
+        }
+    }
+
+    SharedFramePublisher(const SharedFramePublisher&) = delete;
+    SharedFramePublisher& operator=(const SharedFramePublisher&) = delete;
+
+    bool open() {
+        size_t size = sizeof(SharedRingHeader) + shared_slot_stride(slot_size_) * slot_count_;
+        if (!memory_.open(name_, size, true)) {
+            std::cerr << "无法创建共享内存: " << name_ << " (" << std::strerror(errno) << ")" << std::endl;
+            return false;
+        }
+        header_ = new (memory_.data()) SharedRingHeader();
+        for (uint32_t i = 0; i < slot_count_; i++) {
+            new (slot(i)) SharedSlotHeader();
+        }
+        header_->version = SharedRingHeader::kVersion;
+        header_->slot_count = slot_count_;
+        header_->slot_size = slot_size_;
+        header_->write_seq.store(0, std::memory_order_relaxed);
+        header_->closed.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        header_->magic = SharedRingHeader::kMagic;  // 消费者以 magic 判断初始化完成
+        return true;
+    }
+
+    // 发布一帧编码数据，超过槽位大小时返回 false
+    // 编码结果在这里复制一次到槽位，这是发布路径上唯一的一次复制，消费者直接在槽位中读取。
+    // 编码器不直接写入槽位: 槽位按发布顺序分配，编码期间占住槽位会让先编码完的帧等待，
+    // 顺序锁也会在整个编码期间处于写入状态，读取方只能丢帧；复制一帧的开销远小于编码
+    bool publish(const uint8_t* data, size_t size, int64_t timestamp) {
+        if (size > slot_size_) {
+            std::cerr << "帧大小 " << size << " 超过共享内存槽位大小 " << slot_size_ << std::endl;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t n = header_->write_seq.load(std::memory_order_relaxed);
+        SharedSlotHeader* s = slot(static_cast<uint32_t>(n % slot_count_));
+        s->seq.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s->timestamp = timestamp;
+        s->size = static_cast<uint32_t>(size);
+        std::memcpy(reinterpret_cast<uint8_t*>(s + 1), data, size);
+        s->seq.store(2 * n + 2, std::memory_order_release);
+        header_->write_seq.store(n + 1, std::memory_order_release);
+        return true;
+    }
+
+    const std::string& name() const { return name_; }
+
+private:
+    SharedSlotHeader* slot(uint32_t i) const {
+        return reinterpret_cast<SharedSlotHeader*>(memory_.data() + sizeof(SharedRingHeader) +
+                                                   shared_slot_stride(slot_size_) * i);
+    }
+
+    const std::string name_;
+    const uint32_t slot_count_;
+    const uint32_t slot_size_;
+    SharedMemory memory_;
+    SharedRingHeader* header_ = nullptr;
+    std::mutex mutex_;
+};
+
+// 共享内存环形缓冲区的消费端(供下游进程使用)，从打开时最旧的可用帧开始读取
+class SharedFrameSubscriber {
+public:
+    // 打开发布者创建的缓冲区，发布者尚未创建或未初始化完成时返回 false
+    bool open(const std::string& name) {
+        if (!memory_.open(name, 0, false) || memory_.size() < sizeof(SharedRingHeader)) {
+            return false;
+        }
+        header_ = reinterpret_cast<SharedRingHeader*>(memory_.data());
+        if (header_->magic != SharedRingHeader::kMagic || header_->version != SharedRingHeader::kVersion) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t written = header_->write_seq.load(std::memory_order_acquire);
+        next_ = written > header_->slot_count ? written - header_->slot_count : 0;
+        return true;
+    }
+
+    // 读取下一帧: 有新帧时以共享内存中的数据调用 fn(data, size, timestamp) 并返回 true
+    // fn 返回后数据若已被覆盖则丢弃该帧(计入 dropped)并继续读下一帧；没有新帧时返回 false
+    template <typename Fn>
+    bool read(Fn&& fn) {
+        while (true) {
+            uint64_t written = header_->write_seq.load(std::memory_order_acquire);
+            if (next_ >= written) {
+                return false;
+            }
+            if (written - next_ > header_->slot_count) {
+                dropped_ += written - header_->slot_count - next_;  // 消费太慢，已被覆盖
+                next_ = written - header_->slot_count;
+            }
+            uint64_t n = next_++;
+            const SharedSlotHeader* s = slot(static_cast<uint32_t>(n % header_->slot_count));
+            if (s->seq.load(std::memory_order_acquire) != 2 * n + 2) {
+                dropped_++;
+                continue;
+            }
+            int64_t timestamp = s->timestamp;
+            uint32_t size = std::min(s->size, header_->slot_size);
+            fn(reinterpret_cast<const uint8_t*>(s + 1), static_cast<size_t>(size), timestamp);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s->seq.load(std::memory_order_relaxed) != 2 * n + 2) {
+                dropped_++;
+                continue;
+            }
+            return true;
+        }
+    }
+
+    // 发布者已结束且所有帧都已读完
+    bool finished() const {
+        return header_->closed.load(std::memory_order_acquire) &&
+               next_ >= header_->write_seq.load(std::memory_order_acquire);
+    }
+
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    const SharedSlotHeader* slot(uint32_t i) const {
+        return reinterpret_cast<const SharedSlotHeader*>(memory_.data() + sizeof(SharedRingHeader) +
+                                                         shared_slot_stride(header_->slot_size) * i);
+    }
+
+    SharedMemory memory_;
+    SharedRingHeader* header_ = nullptr;
+    uint64_t next_ = 0;
+    uint64_t dropped_ = 0;
+};
+
+// 摄像头对应的共享内存名称: POSIX 要求以 '/' 开头且不含其他 '/'
+std::string shared_ring_name(const std::string& base, const std::string& camera) {
+    std::string name = base + "_" + camera;
+    std::replace(name.begin(), name.end(), '/', '_');
+    std::replace(name.begin(), name.end(), '\\', '_');
+#ifdef _WIN32
+    return name;
+#else
+    return "/" + name;
+#endif
+}
+
+// 单个摄像头的处理结果
+struct CameraResult {
+    std::string prefix;
+    bool success = false;
+    double seconds = 0.0;
+};
+
+// 一个摄像头的输入输出路径
+struct CameraJob {
+    std::string name;     // 摄像头名称，多个数据盘时带有数据盘目录名前缀
+    fs::path video;
+    fs::path index;
+    fs::path output_dir;
+    // 批处理中按时间切分的任务只处理 [begin_ms, end_ms] 内的索引条目，小于 0 表示不限
+    int64_t begin_ms = -1;
+    int64_t end_ms = -1;
+};
+
+// 摄像头列表和输入输出根目录，来自命令行或配置文件
+// 默认每个摄像头读取 <input>/<camera>.mp4 和 <input>/<camera>.txt，输出到 <output>/<camera>；
+// 单个摄像头可以分别覆盖这三个路径
+struct JobConfig {
+    std::vector<std::string> cameras = {
         "ofilm_around_front_190_3M",
         "ofilm_around_rear_190_3M",
         "ofilm_around_left_190_3M",
         "ofilm_around_right_190_3M"
     };
-    
-    // 默认路径
-    std::string video_dir = "c:\\Users\\bykong4\\Desktop\\image\\video";
-    std::string output_base = "c:\\Users\\bykong4\\Desktop\\image";
-    
-    // 处理每个摄像头
-    bool all_success = true;
-    for (const auto& prefix : cameras) {
-        std::string video_path = video_dir + "\\" + prefix + ".mp4";
-        std::string txt_path = video_dir + "\\" + prefix + ".txt";
-        std::string output_dir = output_base + "\\" + prefix;
-        
-        // 检查文件是否存在
-        if (!fs::exists(video_path)) {
-            std::cerr << "错误: 视频文件不存在: " << video_path << std::endl;
-            all_success = false;
+    // 没有内置的默认目录，须由 --input/--output 或配置文件给出(见 missing_job_paths)
+    fs::path input_root;
+    fs::path output_root;
+    // 数据盘目录的通配模式，不为空时对每个匹配的目录分别处理，输出到 <output>/<数据盘目录名>
+    std::string drives;
+    // 批处理的录制会话目录，与数据盘目录相同处理
+    std::vector<fs::path> sessions;
+    std::map<std::string, fs::path> video_overrides;
+    std::map<std::string, fs::path> index_overrides;
+    std::map<std::string, fs::path> output_overrides;
+};
+
+// 通配符匹配，支持 * 和 ?
+static bool wildcard_match(const char* pattern, const char* text) {
+    const char* star = nullptr;
+    const char* resume = nullptr;
+    while (*text) {
+        if (*pattern == '?' || *pattern == *text) {
+            pattern++;
+            text++;
+        } else if (*pattern == '*') {
+            star = pattern++;
+            resume = text;
+        } else if (star) {
+            pattern = star + 1;
+            text = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+// 展开路径中的通配符(可出现在任意一级目录)，返回排序后的已存在的目录
+std::vector<fs::path> glob_directories(const std::string& pattern) {
+    std::vector<fs::path> matches = {fs::path(pattern).root_path()};
+    if (matches[0].empty()) {
+        matches[0] = ".";
+    }
+    for (const auto& component : fs::path(pattern).relative_path()) {
+        std::string name = component.string();
+        std::vector<fs::path> next;
+        for (const auto& base : matches) {
+            if (name.find_first_of("*?") == std::string::npos) {
+                if (fs::is_directory(base / component)) {
+                    next.push_back(base / component);
+                }
+                continue;
+            }
+            std::error_code ec;
+            for (const auto& entry : fs::directory_iterator(base, ec)) {
+                if (entry.is_directory(ec) && wildcard_match(name.c_str(), entry.path().filename().string().c_str())) {
+                    next.push_back(entry.path());
+                }
+            }
+        }
+        matches = std::move(next);
+    }
+    std::sort(matches.begin(), matches.end());
+    return matches;
+}
+
+// 检查任务的输入输出路径是否都已给出，单个摄像头的路径覆盖也算；返回缺少的选项说明，齐全时返回空
+// writes_output 为 false (发布到共享内存)时不需要输出目录
+std::string missing_job_paths(const JobConfig& config, bool writes_output) {
+    auto covered = [&](const std::map<std::string, fs::path>& overrides) {
+        return std::all_of(config.cameras.begin(), config.cameras.end(),
+                           [&](const std::string& camera) { return overrides.count(camera) > 0; });
+    };
+    const bool multi_root = !config.drives.empty() || !config.sessions.empty();
+    if (config.input_root.empty() && !multi_root &&
+        !(covered(config.video_overrides) && covered(config.index_overrides))) {
+        return "--input、--drives 或 --sessions";
+    }
+    if (writes_output && config.output_root.empty() && (multi_root || !covered(config.output_overrides))) {
+        return "--output";
+    }
+    return std::string();
+}
+
+// 按配置生成摄像头任务，每个数据盘(或唯一的输入目录)一组，组内按摄像头顺序排列
+std::vector<std::vector<CameraJob>> build_camera_jobs(const JobConfig& config) {
+    std::vector<std::pair<fs::path, fs::path>> roots;  // 输入目录、输出目录
+    const bool multi_root = !config.drives.empty() || !config.sessions.empty();
+    if (!multi_root) {
+        roots.emplace_back(config.input_root, config.output_root);
+    }
+    if (!config.drives.empty()) {
+        for (const auto& drive : glob_directories(config.drives)) {
+            roots.emplace_back(drive, config.output_root / drive.filename());
+        }
+    }
+    for (const auto& session : config.sessions) {
+        roots.emplace_back(session, config.output_root / session.filename());
+    }
+
+    std::vector<std::vector<CameraJob>> groups;
+    for (const auto& root : roots) {
+        std::string drive = multi_root ? root.first.filename().string() + "/" : "";
+        std::vector<CameraJob> group;
+        for (const auto& camera : config.cameras) {
+            CameraJob job;
+            job.name = drive + camera;
+            auto video = config.video_overrides.find(camera);
+            auto index = config.index_overrides.find(camera);
+            auto output = config.output_overrides.find(camera);
+            job.video = video != config.video_overrides.end() ? video->second : root.first / (camera + ".mp4");
+            job.index = index != config.index_overrides.end() ? index->second : root.first / (camera + ".txt");
+            job.output_dir = output != config.output_overrides.end() ? output->second : root.second / camera;
+            group.push_back(std::move(job));
+        }
+        groups.push_back(std::move(group));
+    }
+    return groups;
+}
+
+// 读取配置文件，每行为一个去掉 "--" 的命令行选项及其参数，如 "queue-depth 8"，# 开头为注释
+// 返回与命令行等价的参数列表，由 main 统一解析，后出现的选项覆盖先出现的
+bool load_config_args(const std::string& path, std::vector<std::string>& args) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cerr << "无法打开配置文件: " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key) || key[0] == '#') {
             continue;
         }
-        
-        if (!fs::exists(txt_path)) {
-            std::cerr << "错误: 索引文件不存在: " << txt_path << std::endl;
-            all_success = false;
-            continue;
+        args.push_back("--" + key);
+        std::string value;
+        while (fields >> value) {
+            args.push_back(value);
+        }
+    }
+    return true;
+}
+
+// 读取视频流的宽高(探测缓存命中时直接使用缓存)，用于在解码前确定共享内存槽位大小
+static bool probe_video_size(const std::string& video_path, const std::string& cache_dir,
+                             int& width, int& height) {
+    ProbeInfo info;
+    if (!cache_dir.empty() && load_probe_info(cache_dir, video_path, info) && info.width > 0 && info.height > 0) {
+        width = info.width;
+        height = info.height;
+        return true;
+    }
+
+    AVFormatContext* format_ctx = nullptr;
+    int ret = avformat_open_input(&format_ctx, video_path.c_str(), nullptr, nullptr);
+    if (ret != 0) {
+        std::cerr << "无法打开视频文件: " << video_path << " (" << av_err2str(ret) << ")" << std::endl;
+        return false;
+    }
+    width = 0;
+    height = 0;
+    if (avformat_find_stream_info(format_ctx, nullptr) >= 0) {
+        for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+            const AVCodecParameters* par = format_ctx->streams[i]->codecpar;
+            if (par->codec_type == AVMEDIA_TYPE_VIDEO) {
+                width = par->width;
+                height = par->height;
+                break;
+            }
+        }
+    }
+    avformat_close_input(&format_ctx);
+    if (width <= 0 || height <= 0) {
+        std::cerr << "无法获取视频尺寸: " << video_path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// 处理单个摄像头的视频和索引文件
+bool process_camera(const CameraJob& job, const ExtractOptions& base_options, StreamStats* stats) {
+    ExtractOptions options = base_options;
+    if (job.begin_ms >= 0) {
+        options.select_begin_ms = std::max(options.select_begin_ms, job.begin_ms);
+    }
+    if (job.end_ms >= 0) {
+        options.select_end_ms = options.select_end_ms >= 0 ? std::min(options.select_end_ms, job.end_ms)
+                                                           : job.end_ms;
+    }
+    const std::string prefix = job.name;
+    const std::string video_path = job.video.string();
+    const std::string txt_path = job.index.string();
+    const std::string output_dir = job.output_dir.string();
+
+    // 检查文件是否存在
+    if (!fs::exists(video_path)) {
+        std::cerr << "错误: 视频文件不存在: " << video_path << std::endl;
+        stats->fail("video");
+        return false;
+    }
+
+    if (!fs::exists(txt_path)) {
+        std::cerr << "错误: 索引文件不存在: " << txt_path << std::endl;
+        stats->fail("index");
+        return false;
+    }
+
+    // 发布到共享内存时不写文件
+    std::unique_ptr<SharedFramePublisher> publisher;
+    if (!options.shm_name.empty()) {
+        // 槽位大小未指定时按视频尺寸取单帧上限；未压缩的原始帧大小固定，
+        // 指定的槽位放不下时在解码前直接失败，不必每帧发布失败
+        int width = 0;
+        int height = 0;
+        if (!probe_video_size(video_path, options.probe_cache_dir, width, height)) {
+            stats->fail("video");
+            return false;
+        }
+        size_t frame_size = max_published_frame_size(options, width, height);
+        if (options.shm_slot_size <= 0) {
+            if (frame_size == 0 || frame_size > static_cast<size_t>(INT_MAX)) {
+                std::cerr << "错误: 无法确定共享内存槽位大小: " << width << "x" << height << std::endl;
+                stats->fail("output");
+                return false;
+            }
+            options.shm_slot_size = static_cast<int>(frame_size);
+        } else if (is_raw_output_format(selected_output_format(options).format) &&
+                   options.output_compression == "none" &&
+                   static_cast<size_t>(options.shm_slot_size) < frame_size) {
+            std::cerr << "错误: 共享内存槽位大小 " << options.shm_slot_size << " 字节小于每帧 " << frame_size
+                      << " 字节 (" << width << "x" << height << ")" << std::endl;
+            stats->fail("output");
+            return false;
         }
-        
-        // 确保输出目录存在
-        if (!fs::exists(output_dir) && !fs::create_directories(output_dir)) {
-            std::cerr << "错误: 无法创建输出目录: " << output_dir << std::endl;
-            all_success = false;
+        publisher = std::make_unique<SharedFramePublisher>(shared_ring_name(options.shm_name, prefix),
+                                                           options.shm_slots, options.shm_slot_size);
+        if (!publisher->open()) {
+            stats->fail("output");
+            return false;
+        }
+        SharedFramePublisher* ring = publisher.get();
+        options.packet_sink = [ring](const AVPacket* packet, int64_t timestamp) {
+            return ring->publish(packet->data, static_cast<size_t>(packet->size), timestamp);
+        };
+        std::cout << prefix << ": 发布到共享内存 " << ring->name() << " (" << options.shm_slots << " 个槽位, 每个 "
+                  << options.shm_slot_size << " 字节)" << std::endl;
+    }
+
+    // 确保输出目录存在
+    if (!options.packet_sink && !fs::exists(output_dir) && !fs::create_directories(output_dir)) {
+        std::cerr << "错误: 无法创建输出目录: " << output_dir << std::endl;
+        stats->fail("output");
+        return false;
+    }
+
+    if (!decode_video_to_images(video_path, txt_path, output_dir, options, stats)) {
+        std::cerr << "处理失败: " << prefix << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// ---- 批处理 ----
+
+// 读取会话列表文件: 每行一个会话目录，# 开头为注释
+bool load_session_list(const std::string& path, std::vector<fs::path>& sessions) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cerr << "无法打开会话列表: " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty() && line[0] != '#') {
+            sessions.emplace_back(line);
+        }
+    }
+    return true;
+}
+
+// 读取索引文件的首尾时间戳，失败或为空时返回 false
+static bool read_index_range(const fs::path& path, int64_t& first, int64_t& last) {
+    std::vector<int64_t> timestamps;
+    if (!read_index_file(path.string(), timestamps) || timestamps.empty()) {
+        return false;
+    }
+    first = timestamps.front();
+    last = timestamps.back();
+    return true;
+}
+
+// 把每个摄像头按索引时间切成约 split_ms 毫秒的任务，使长视频的尾部也能分摊到多个线程
+// 每个任务通过选择性提取跳转到区间之前最近的关键帧开始解码，相邻任务只多解码不到一个 GOP
+std::vector<CameraJob> split_camera_jobs(const std::vector<CameraJob>& jobs, int64_t split_ms) {
+    std::vector<CameraJob> tasks;
+    for (const auto& job : jobs) {
+        int64_t first = 0, last = 0;
+        if (split_ms <= 0 || !read_index_range(job.index, first, last) || last - first < split_ms) {
+            tasks.push_back(job);
             continue;
         }
-        
-        if (!decode_video_to_images(video_path, txt_path, output_dir)) {
-            std::cerr << "处理失败: " << prefix << std::endl;
-            all_success = false;
+        for (int64_t begin = first; begin <= last; begin += split_ms) {
+            CameraJob task = job;
+            task.begin_ms = begin;
+            task.end_ms = std::min(last, begin + split_ms - 1);
+            task.name = job.name + "[" + std::to_string(task.begin_ms) + "-" + std::to_string(task.end_ms) + "]";
+            tasks.push_back(std::move(task));
+        }
+    }
+    return tasks;
+}
+
+// 工作窃取线程池: 每个线程有自己的任务队列，从队首按顺序取任务；
+// 自己的队列为空时从其他线程的队尾窃取，跨会话边界也不会有空闲的核心
+// 同一会话的任务分给同一个线程，使各会话大致按顺序完成
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(int threads) : queues_(static_cast<size_t>(std::max(1, threads))) {}
+
+    // 在 threads 个线程(含调用线程)上运行所有任务，owner[i] 决定任务 i 最初归属哪个线程
+    void run(std::vector<std::function<void()>> tasks, const std::vector<size_t>& owner) {
+        for (size_t i = 0; i < tasks.size(); i++) {
+            queues_[owner[i] % queues_.size()].tasks.push_back(std::move(tasks[i]));
+        }
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < queues_.size(); i++) {
+            threads.emplace_back(&WorkStealingPool::worker_loop, this, i);
+        }
+        worker_loop(0);
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    // 从其他线程窃取的任务数
+    uint64_t steals() const { return steals_.load(); }
+
+private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool take_own(size_t self, std::function<void()>& task) {
+        std::lock_guard<std::mutex> lock(queues_[self].mutex);
+        if (queues_[self].tasks.empty()) {
+            return false;
+        }
+        task = std::move(queues_[self].tasks.front());
+        queues_[self].tasks.pop_front();
+        return true;
+    }
+
+    bool steal(size_t self, std::function<void()>& task) {
+        for (size_t offset = 1; offset < queues_.size(); offset++) {
+            TaskQueue& victim = queues_[(self + offset) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.back());
+                victim.tasks.pop_back();
+                steals_++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 任务只在 run 开始前放入，所有队列都为空即可退出
+    void worker_loop(size_t self) {
+        std::function<void()> task;
+        while (take_own(self, task) || steal(self, task)) {
+            task();
+            task = nullptr;
+        }
+    }
+
+    std::vector<TaskQueue> queues_;
+    std::atomic<uint64_t> steals_{0};
+};
+
+// 环视同步分组: 多路摄像头同时解码，按索引时间戳对齐，每个时刻输出一组帧
+// 各路解码线程把匹配到的帧放入各自的有界队列，分组线程按时间顺序取帧对齐
+struct TimedFrame {
+    AVFrame* frame = nullptr;
+    int64_t timestamp = 0;  // 索引中的毫秒时间戳
+};
+
+class FrameGrouper {
+public:
+    // tolerance_ms: 同一组内各路帧时间戳的最大差值；depth: 每路队列深度
+    FrameGrouper(size_t streams, int64_t tolerance_ms, size_t depth)
+        : tolerance_(tolerance_ms), heads_(streams), dropped_(streams, 0) {
+        for (size_t i = 0; i < streams; i++) {
+            queues_.push_back(std::make_unique<BoundedQueue<TimedFrame>>(depth));
+        }
+    }
+
+    ~FrameGrouper() { close(); }
+
+    FrameGrouper(const FrameGrouper&) = delete;
+    FrameGrouper& operator=(const FrameGrouper&) = delete;
+
+    // 由解码线程调用，接管 frame；分组已结束时释放帧并返回 false
+    bool push(size_t stream, AVFrame* frame, int64_t timestamp) {
+        if (!queues_[stream]->push(TimedFrame{frame, timestamp})) {
+            av_frame_free(&frame);
+            return false;
+        }
+        return true;
+    }
+
+    // 某路视频流解码结束
+    void end_stream(size_t stream) { queues_[stream]->close(); }
+
+    // 取下一组对齐的帧，group[i] 为第 i 路的帧，调用方接管这些帧
+    // 每次丢弃比当前最新队首早超过容差的帧，直到所有队首落在容差之内；任一路结束时返回 false
+    bool next(std::vector<TimedFrame>& group) {
+        while (true) {
+            for (size_t i = 0; i < heads_.size(); i++) {
+                if (!heads_[i].frame && !queues_[i]->pop(heads_[i])) {
+                    return false;
+                }
+            }
+            int64_t newest = heads_[0].timestamp;
+            for (const auto& head : heads_) {
+                newest = std::max(newest, head.timestamp);
+            }
+            bool aligned = true;
+            for (size_t i = 0; i < heads_.size(); i++) {
+                if (heads_[i].timestamp < newest - tolerance_) {
+                    av_frame_free(&heads_[i].frame);
+                    dropped_[i]++;
+                    aligned = false;
+                }
+            }
+            if (aligned) {
+                group = heads_;
+                for (auto& head : heads_) {
+                    head.frame = nullptr;
+                }
+                return true;
+            }
+        }
+    }
+
+    // 结束分组并释放所有未取走的帧，阻塞在 push 上的解码线程随之返回
+    void close() {
+        for (auto& queue : queues_) {
+            queue->close();
+        }
+        for (size_t i = 0; i < heads_.size(); i++) {
+            av_frame_free(&heads_[i].frame);
+            TimedFrame item;
+            while (queues_[i]->pop(item)) {
+                av_frame_free(&item.frame);
+            }
+        }
+    }
+
+    // 第 i 路因找不到同步帧而丢弃的帧数
+    uint64_t dropped(size_t stream) const { return dropped_[stream]; }
+
+private:
+    const int64_t tolerance_;
+    std::vector<std::unique_ptr<BoundedQueue<TimedFrame>>> queues_;
+    std::vector<TimedFrame> heads_;
+    std::vector<uint64_t> dropped_;
+};
+
+// 把一组 YUV420P 帧拼成 2x2 马赛克: 按摄像头顺序依次为左上、右上、左下、右下
+// 每格大小取组内最大的宽高，较小的帧放在格子左上角，空白处填黑色；色彩范围沿用第一帧
+AVFrame* compose_mosaic(const std::vector<TimedFrame>& group, FramePool& pool) {
+    int cell_width = 0;
+    int cell_height = 0;
+    for (const auto& item : group) {
+        cell_width = std::max(cell_width, item.frame->width);
+        cell_height = std::max(cell_height, item.frame->height);
+    }
+    cell_width = (cell_width + 1) & ~1;
+    cell_height = (cell_height + 1) & ~1;
+    const int columns = 2;
+    const int rows = static_cast<int>((group.size() + columns - 1) / columns);
+
+    AVFrame* mosaic = pool.get(cell_width * columns, cell_height * rows, AV_PIX_FMT_YUV420P);
+    if (!mosaic) {
+        std::cerr << "无法分配马赛克帧" << std::endl;
+        return nullptr;
+    }
+    bool full_range = is_full_range(group[0].frame);
+    mosaic->color_range = full_range ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+    memset(mosaic->data[0], full_range ? 0 : 16, static_cast<size_t>(mosaic->linesize[0]) * mosaic->height);
+    memset(mosaic->data[1], 128, static_cast<size_t>(mosaic->linesize[1]) * (mosaic->height / 2));
+    memset(mosaic->data[2], 128, static_cast<size_t>(mosaic->linesize[2]) * (mosaic->height / 2));
+
+    for (size_t i = 0; i < group.size(); i++) {
+        const AVFrame* frame = group[i].frame;
+        int x = static_cast<int>(i % columns) * cell_width;
+        int y = static_cast<int>(i / columns) * cell_height;
+        for (int plane = 0; plane < 3; plane++) {
+            int shift = plane == 0 ? 0 : 1;
+            uint8_t* dst = mosaic->data[plane] + static_cast<ptrdiff_t>(y >> shift) * mosaic->linesize[plane] +
+                           (x >> shift);
+            av_image_copy_plane(dst, mosaic->linesize[plane], frame->data[plane], frame->linesize[plane],
+                                AV_CEIL_RSHIFT(frame->width, shift), AV_CEIL_RSHIFT(frame->height, shift));
+        }
+    }
+    return mosaic;
+}
+
+// 同步分组处理多路摄像头
+// record: 每个时刻的各路帧按输出格式编码后写入同一个打包文件，时间戳相同、slot 为摄像头序号
+// mosaic: 每个时刻拼成一张 2x2 马赛克，按输出格式和输出方式写出
+// 输出位于 output_dir，以第一路摄像头的索引时间戳命名
+bool process_camera_group(const std::vector<CameraJob>& cameras,
+                          const std::string& output_dir,
+                          const ExtractOptions& options,
+                          const std::vector<StreamStats*>& camera_stats,
+                          StreamStats* group_stats,
+                          std::vector<CameraResult>& results) {
+    for (const auto& job : cameras) {
+        if (!fs::exists(job.video) || !fs::exists(job.index)) {
+            std::cerr << "错误: 视频或索引文件不存在: " << job.name << std::endl;
+            return false;
+        }
+    }
+    if (!fs::exists(output_dir) && !fs::create_directories(output_dir)) {
+        std::cerr << "错误: 无法创建输出目录: " << output_dir << std::endl;
+        return false;
+    }
+
+    const bool mosaic = options.group_mode == "mosaic";
+    std::unique_ptr<PackWriter> pack;
+    if (!mosaic || options.pack_output) {
+        pack = std::make_unique<PackWriter>(output_dir, options.pack_flush_interval,
+                                            selected_output_format(options).format);
+        if (!pack->open(false)) {
+            return false;
+        }
+    }
+
+    // mosaic 只有一条流水线；record 每路一条，共用打包文件，按各路的标定参数去畸变
+    std::vector<std::unique_ptr<StreamPipeline>> pipelines;
+    const bool undistort = !options.calibration_dir.empty();
+    if (mosaic) {
+        if (undistort) {
+            std::cerr << "马赛克模式不支持去畸变，忽略标定参数" << std::endl;
+        }
+        pipelines.push_back(std::make_unique<StreamPipeline>(options, output_dir, pack.get(), group_stats));
+    } else {
+        for (size_t i = 0; i < cameras.size(); i++) {
+            FisheyeCalibration calibration;
+            if (undistort && !load_fisheye_calibration(
+                                 calibration_path(options, cameras[i].video.string()),
+                                 calibration)) {
+                return false;
+            }
+            pipelines.push_back(std::make_unique<StreamPipeline>(options, output_dir, pack.get(), group_stats,
+                                                                 static_cast<uint32_t>(i),
+                                                                 undistort ? &calibration : nullptr));
+        }
+    }
+
+    // 各路解码线程在送入分组队列前取回硬件帧，马赛克模式下还统一为 YUV420P，
+    // 分组线程只做对齐和拼接
+    FrameGrouper grouper(cameras.size(), options.group_tolerance_ms,
+                         static_cast<size_t>(std::max(1, options.queue_depth)));
+    std::vector<std::thread> decoders;
+    for (size_t i = 0; i < cameras.size(); i++) {
+        results[i].prefix = cameras[i].name;
+        decoders.emplace_back([&, i]() {
+            FramePool download_pool;
+            FrameConverter converter;
+            auto start = std::chrono::steady_clock::now();
+            camera_stats[i]->start = start;
+            camera_stats[i]->started = true;
+            FrameHandler handler = [&](AVFrame* frame, int64_t timestamp) {
+                const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+                if (desc && (desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+                    AVFrame* sw_frame = download_hw_frame(frame, options.hwaccel_map, download_pool);
+                    av_frame_free(&frame);
+                    if (!sw_frame) {
+                        return false;
+                    }
+                    frame = sw_frame;
+                }
+                if (mosaic && frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_YUVJ420P) {
+                    AVFrame* converted_frame = converter.convert(frame);
+                    av_frame_free(&frame);
+                    if (!converted_frame) {
+                        return false;
+                    }
+                    frame = converted_frame;
+                }
+                return grouper.push(i, frame, timestamp);
+            };
+            results[i].success = decode_video_to_images(cameras[i].video.string(), cameras[i].index.string(),
+                                                        "", options, camera_stats[i], handler);
+            grouper.end_stream(i);
+            results[i].seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+            camera_stats[i]->seconds = results[i].seconds;
+            camera_stats[i]->success = results[i].success;
+        });
+    }
+
+    group_stats->start = std::chrono::steady_clock::now();
+    group_stats->started = true;
+    FramePool mosaic_pool;
+    std::vector<TimedFrame> group;
+    bool success = true;
+    uint64_t group_count = 0;
+    while (grouper.next(group)) {
+        int64_t timestamp = group[0].timestamp;
+        if (mosaic) {
+            AVFrame* mosaic_frame = compose_mosaic(group, mosaic_pool);
+            for (auto& item : group) {
+                av_frame_free(&item.frame);
+            }
+            if (!mosaic_frame) {
+                success = false;
+                break;
+            }
+            pipelines[0]->submit(mosaic_frame, timestamp);
+        } else {
+            for (size_t i = 0; i < group.size(); i++) {
+                pipelines[i]->submit(group[i].frame, timestamp);
+            }
+        }
+        group_count++;
+    }
+
+    // 任一路结束后不会再有完整的组，停止其余各路的解码
+    grouper.close();
+    for (auto& t : decoders) {
+        t.join();
+    }
+    for (auto& pipeline : pipelines) {
+        if (!pipeline->finish()) {
+            success = false;
+        }
+    }
+    if (pack && !pack->close()) {
+        success = false;
+    }
+    group_stats->seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - group_stats->start).count();
+    group_stats->success = success;
+
+    std::cout << "同步分组 " << group_count << " 组 (" << options.group_mode << "): " << output_dir << std::endl;
+    for (size_t i = 0; i < cameras.size(); i++) {
+        if (grouper.dropped(i) > 0) {
+            std::cout << "  " << cameras[i].name << ": " << grouper.dropped(i) << " 帧没有同步帧，已丢弃" << std::endl;
+        }
+    }
+    return success;
+}
+
+// 基准测试等程序可以定义 RESTORE_NO_MAIN 后直接包含本文件，复用上面的各个阶段
+#ifndef RESTORE_NO_MAIN
+// 命令行用法
+static void print_usage(const char* program) {
+    std::cerr << "用法: " << program
+              << " [--config FILE] [--input DIR] [--output DIR] [--cameras A,B,...]"
+              << " [--drives GLOB] [--camera-video|--camera-index|--camera-output CAMERA PATH]"
+              << " [--sessions FILE] [--split-ms N]"
+              << " [--jobs N] [--queue-depth N] [--encode-threads N]"
+              << " [--timestamps T1,T2,...] [--time-range BEGIN:END]"
+              << " [--sample-every N] [--sample-fps F] [--keyframes-only] [--dedupe T]"
+              << " [--match-tolerance MS] [--hwaccel TYPE] [--hwaccel-device DEV]"
+              << " [--hwaccel-map] [--decode-threads N] [--decode-thread-type frame|slice|auto]"
+              << " [--segment-workers N] [--max-decode-errors N]"
+              << " [--jpeg-threads N] [--write-threads N] [--write-batch N]"
+              << " [--undistort DIR] [--output-size WxH] [--remap-threads N]"
+              << " [--crop WxH+X+Y] [--profile NAME:crop=WxH+X+Y,size=WxH,format=FMT,quality=Q]"
+              << " [--group record|mosaic] [--group-tolerance MS]"
+              << " [--pack] [--pack-flush N] [--resume]"
+              << " [--probe-cache DIR] [--memory-budget MB]"
+              << " [--publish-shm NAME] [--shm-slots N] [--shm-slot-size BYTES]"
+              << " [--stats-json PATH] [--stats-interval SEC]"
+              << " [--quality Q] [--jpeg-backend ffmpeg|turbojpeg|gpu|auto]"
+              << " [--output-format FMT] [--compress none|lz4|zstd] [--compress-level N]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    #ifdef _WIN32
+    // 设置 DLL 搜索路径 - 指向本地 FFmpeg 安装目录
+    const char* dllPath = "D:\\ffmpeg-n7.1.1-56-gc2184b65d2-win64-gpl-shared-7.1\\bin";
+    if (!SetDllDirectoryA(dllPath)) {
+        std::cerr << "Failed to set DLL directory: " << GetLastError() << std::endl;
+        return 1;
+    }
+    #endif
+
+    // 解析命令行参数
+    // --config FILE: 从文件读取选项，每行一个去掉 "--" 的选项，如 "input /data/video"
+    // --input DIR: 视频和索引文件所在目录 (<DIR>/<摄像头>.mp4 和 .txt)
+    // --output DIR: 输出根目录，每个摄像头输出到 <DIR>/<摄像头>
+    // --cameras A,B,...: 要处理的摄像头列表
+    // --drives GLOB: 处理所有匹配的数据盘目录，如 /mnt/drives/*，每个目录相当于一个 --input，
+    //                输出到 <output>/<数据盘目录名>
+    // --camera-video / --camera-index / --camera-output CAMERA PATH: 覆盖单个摄像头的路径
+    // --sessions FILE: 批处理，FILE 中每行一个录制会话目录，与 --drives 相同处理
+    // --split-ms N: 批处理时把每个摄像头按索引时间切成约 N 毫秒的任务，由工作窃取线程池调度
+    // --jobs N: 同时处理的摄像头数量，0 表示按 CPU 核数自动选择
+    // --queue-depth N: 流水线各阶段之间的队列深度，0 表示同步处理
+    // --encode-threads N: 每路视频流的 JPEG 编码线程数
+    // --timestamps T1,T2,...: 只提取最接近这些毫秒时间戳的帧
+    // --time-range BEGIN:END: 只提取该毫秒时间范围内的帧，任一端可省略
+    // --sample-every N: 每 N 个索引条目取一帧
+    // --sample-fps F: 按 F 帧/秒抽帧
+    // --keyframes-only: 只解码和输出关键帧
+    // --match-tolerance MS: 帧时间戳与索引时间戳匹配的最大误差，也用于 --timestamps 查找索引条目 (默认半个帧间隔)
+    // --dedupe T: 跳过与上一个保留帧亮度差低于 T (0-255) 的静止帧，记录到 duplicates.txt
+    // --write-threads N: 每路视频流的文件写入线程数
+    // --write-batch N: 写入线程每次从队列取出的最大数据包数
+    // --undistort DIR: 按 DIR/<摄像头>.calib 中的鱼眼标定参数去畸变
+    // --output-size WxH: 输出帧缩放到 W x H (去畸变时直接按此尺寸生成查找表)
+    // --remap-threads N: 每路视频流的去畸变线程数
+    // --crop WxH+X+Y: 只输出该区域(去畸变之后、缩放之前)
+    // --profile NAME:crop=WxH+X+Y,size=WxH,format=FMT,quality=Q: 增加一个输出配置，输出到 <摄像头输出目录>/NAME，
+    //     可重复；同一次解码按每个配置分别裁剪、缩放和编码，未指定的项沿用全局选项
+    // --group record|mosaic: 四路摄像头同时解码并按时间戳同步分组，输出到 surround 目录
+    // --group-tolerance MS: 同一组内各路帧时间戳的最大差值
+    // --probe-cache DIR: 探测结果缓存目录，重复运行时跳过 avformat_find_stream_info
+    // --memory-budget MB: 所有摄像头流水线中在途帧和数据包的内存上限，超出时暂停解码
+    // --publish-shm NAME: 编码结果发布到共享内存环形缓冲区 NAME_<摄像头>，不写文件
+    // --shm-slots N / --shm-slot-size BYTES: 环形缓冲区的槽位数和每个槽位的最大字节数，
+    //   不指定槽位大小时按视频尺寸和输出格式取单帧上限
+    // --pack: 每路视频流输出一个打包文件 (frames.pack + frames.idx) 而不是每帧一个 JPEG
+    // --pack-flush N: 打包模式下每 N 帧刷盘一次
+    // --resume: 断点续传，跳过已存在且完整的输出 (不能与 --group 同时使用)
+    // --stats-json PATH: 运行结束时将各阶段耗时、吞吐量、队列占用、错误计数和失败原因以 JSON 写入 PATH
+    //     ("-" 为标准输出)，failed 列出失败的摄像头，调度方可以只重试这些摄像头
+    // --stats-interval SEC: 每隔 SEC 秒在标准输出打印一行 JSON 进度
+    // --quality Q: JPEG 质量 1-100 (默认 90)
+    // --jpeg-backend ffmpeg|turbojpeg|gpu|auto: JPEG 编码后端，gpu 直接编码硬件解码的帧 (VAAPI/QSV)
+    // --output-format FMT: 输出格式 jpeg/yuv420p/nv12/rgb24/gbrp/png/webp
+    // --compress none|lz4|zstd: 原始格式的压缩方式
+    // --compress-level N: zstd 压缩级别或 lz4 加速因子
+    // --decode-threads N: 每路视频流的解码线程数，0 表示按 CPU 预算自动分配
+    // --decode-thread-type frame|slice|auto: 解码器线程类型
+    // --segment-workers N: 每路视频按关键帧切分，由 N 个解复用器/解码器并行解码
+    // --max-decode-errors N: 一路视频的解码错误达到 N 个时放弃这一路 (默认不限制)
+    // --jpeg-threads N: 每个 JPEG 编码器上下文的切片线程数
+    // --hwaccel TYPE: 硬件解码 (vaapi/cuda/qsv/d3d11va/auto)，不可用时自动退回软件解码
+    // --hwaccel-device DEV: 硬件设备路径或编号
+    // --hwaccel-map: 尝试零拷贝映射硬件帧
+    // 退出码: 0 全部成功，1 参数或配置错误，2 部分摄像头失败，3 全部失败
+    int jobs = 1;
+    ExtractOptions options;
+    std::string stats_json_path;
+    double stats_interval = 0.0;
+    JobConfig jobs_config;
+    int64_t split_ms = 0;
+    int64_t memory_budget_mb = 0;
+    std::function<int(int, char**)> parse_args = [&](int count, char** values) -> int {
+        for (int i = 0; i < count; i++) {
+            std::string arg = values[i];
+            if (arg == "--config" && i + 1 < count) {
+                // 配置文件中的选项按出现位置展开，之后的命令行选项可以覆盖它们
+                std::vector<std::string> config_args;
+                if (!load_config_args(values[++i], config_args)) {
+                    return 1;
+                }
+                std::vector<char*> config_values;
+                for (auto& value : config_args) {
+                    config_values.push_back(&value[0]);
+                }
+                if (int status = parse_args(static_cast<int>(config_values.size()), config_values.data())) {
+                    return status;
+                }
+            } else if (arg == "--input" && i + 1 < count) {
+                jobs_config.input_root = values[++i];
+            } else if (arg == "--output" && i + 1 < count) {
+                jobs_config.output_root = values[++i];
+            } else if (arg == "--cameras" && i + 1 < count) {
+                jobs_config.cameras.clear();
+                std::stringstream list(values[++i]);
+                std::string item;
+                while (std::getline(list, item, ',')) {
+                    if (!item.empty()) {
+                        jobs_config.cameras.push_back(item);
+                    }
+                }
+            } else if (arg == "--sessions" && i + 1 < count) {
+                if (!load_session_list(values[++i], jobs_config.sessions)) {
+                    return 1;
+                }
+            } else if (arg == "--split-ms" && i + 1 < count) {
+                split_ms = std::strtoll(values[++i], nullptr, 10);
+            } else if (arg == "--drives" && i + 1 < count) {
+                jobs_config.drives = values[++i];
+            } else if ((arg == "--camera-video" || arg == "--camera-index" || arg == "--camera-output") &&
+                       i + 2 < count) {
+                std::string camera = values[++i];
+                fs::path path = values[++i];
+                auto& overrides = arg == "--camera-video" ? jobs_config.video_overrides
+                                  : arg == "--camera-index" ? jobs_config.index_overrides
+                                                            : jobs_config.output_overrides;
+                overrides[camera] = path;
+            } else if ((arg == "--jobs" || arg == "-j") && i + 1 < count) {
+                jobs = std::atoi(values[++i]);
+            } else if (arg == "--queue-depth" && i + 1 < count) {
+                options.queue_depth = std::atoi(values[++i]);
+            } else if (arg == "--encode-threads" && i + 1 < count) {
+                options.encode_threads = std::atoi(values[++i]);
+            } else if (arg == "--timestamps" && i + 1 < count) {
+                std::stringstream list(values[++i]);
+                std::string item;
+                while (std::getline(list, item, ',')) {
+                    if (!item.empty()) {
+                        options.select_timestamps.push_back(std::strtoll(item.c_str(), nullptr, 10));
+                    }
+                }
+            } else if (arg == "--write-threads" && i + 1 < count) {
+                options.write_threads = std::atoi(values[++i]);
+            } else if (arg == "--write-batch" && i + 1 < count) {
+                options.write_batch = std::atoi(values[++i]);
+            } else if (arg == "--output-format" && i + 1 < count) {
+                options.output_format = values[++i];
+                const OutputFormatInfo* info = find_output_format(options.output_format);
+                if (!info) {
+                    std::cerr << "未知的输出格式: " << options.output_format << std::endl;
+                    return 1;
+                }
+                if (!output_format_available(*info)) {
+                    std::cerr << "当前 FFmpeg 不支持输出格式: " << options.output_format << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--compress" && i + 1 < count) {
+                options.output_compression = values[++i];
+                if (!frame_compression_available(options.output_compression)) {
+                    std::cerr << "压缩方式不可用: " << options.output_compression
+                              << " (lz4/zstd 需要以 -DRESTORE_WITH_LZ4/-DRESTORE_WITH_ZSTD 编译)" << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--compress-level" && i + 1 < count) {
+                options.compression_level = std::atoi(values[++i]);
+            } else if (arg == "--undistort" && i + 1 < count) {
+                options.calibration_dir = values[++i];
+            } else if (arg == "--output-size" && i + 1 < count) {
+                std::string size = values[++i];
+                size_t x = size.find('x');
+                options.output_width = x == std::string::npos ? 0 : std::atoi(size.substr(0, x).c_str());
+                options.output_height = x == std::string::npos ? 0 : std::atoi(size.substr(x + 1).c_str());
+                if (options.output_width <= 0 || options.output_height <= 0) {
+                    std::cerr << "无效的输出尺寸: " << size << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--crop" && i + 1 < count) {
+                if (!parse_geometry(values[++i], options.crop_width, options.crop_height,
+                                    &options.crop_x, &options.crop_y)) {
+                    std::cerr << "无效的裁剪区域: " << values[i] << std::endl;
+                    return 1;
+                }
+                options.crop_x &= ~1;
+                options.crop_y &= ~1;
+            } else if (arg == "--profile" && i + 1 < count) {
+                OutputProfile profile;
+                if (!parse_output_profile(values[++i], profile)) {
+                    return 1;
+                }
+                options.profiles.push_back(profile);
+            } else if (arg == "--remap-threads" && i + 1 < count) {
+                options.remap_threads = std::max(1, std::atoi(values[++i]));
+            } else if (arg == "--group" && i + 1 < count) {
+                options.group_mode = values[++i];
+                if (options.group_mode != "none" && options.group_mode != "record" &&
+                    options.group_mode != "mosaic") {
+                    std::cerr << "无效的分组方式: " << options.group_mode << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--group-tolerance" && i + 1 < count) {
+                options.group_tolerance_ms = std::strtoll(values[++i], nullptr, 10);
+            } else if (arg == "--pack") {
+                options.pack_output = true;
+            } else if (arg == "--pack-flush" && i + 1 < count) {
+                options.pack_flush_interval = std::atoi(values[++i]);
+            } else if (arg == "--resume") {
+                options.resume = true;
+            } else if (arg == "--stats-json" && i + 1 < count) {
+                stats_json_path = values[++i];
+            } else if (arg == "--stats-interval" && i + 1 < count) {
+                stats_interval = std::atof(values[++i]);
+            } else if (arg == "--quality" && i + 1 < count) {
+                options.jpeg_quality = std::atoi(values[++i]);
+                if (options.jpeg_quality < 1 || options.jpeg_quality > 100) {
+                    std::cerr << "JPEG 质量须在 1-100 之间: " << values[i] << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--jpeg-backend" && i + 1 < count) {
+                options.jpeg_backend = values[++i];
+                if (!jpeg_backend_available(options.jpeg_backend)) {
+                    std::cerr << "JPEG 编码后端不可用: " << options.jpeg_backend
+                              << " (turbojpeg 需要以 -DRESTORE_WITH_TURBOJPEG 编译并链接 -lturbojpeg)" << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--decode-threads" && i + 1 < count) {
+                options.decode_threads = std::atoi(values[++i]);
+            } else if (arg == "--segment-workers" && i + 1 < count) {
+                options.segment_workers = std::max(1, std::atoi(values[++i]));
+            } else if (arg == "--max-decode-errors" && i + 1 < count) {
+                options.max_decode_errors = std::max(0, std::atoi(values[++i]));
+            } else if (arg == "--decode-thread-type" && i + 1 < count) {
+                options.decode_thread_type = values[++i];
+                if (options.decode_thread_type != "frame" && options.decode_thread_type != "slice" &&
+                    options.decode_thread_type != "auto") {
+                    std::cerr << "无效的线程类型: " << options.decode_thread_type << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--jpeg-threads" && i + 1 < count) {
+                options.jpeg_threads = std::atoi(values[++i]);
+            } else if (arg == "--hwaccel" && i + 1 < count) {
+                options.hwaccel = values[++i];
+            } else if (arg == "--hwaccel-device" && i + 1 < count) {
+                options.hwaccel_device = values[++i];
+            } else if (arg == "--hwaccel-map") {
+                options.hwaccel_map = true;
+            } else if (arg == "--sample-every" && i + 1 < count) {
+                options.sample_every = std::max(1, std::atoi(values[++i]));
+            } else if (arg == "--sample-fps" && i + 1 < count) {
+                options.sample_fps = std::atof(values[++i]);
+            } else if (arg == "--keyframes-only") {
+                options.keyframes_only = true;
+            } else if (arg == "--probe-cache" && i + 1 < count) {
+                options.probe_cache_dir = values[++i];
+            } else if (arg == "--memory-budget" && i + 1 < count) {
+                memory_budget_mb = std::strtoll(values[++i], nullptr, 10);
+            } else if (arg == "--publish-shm" && i + 1 < count) {
+                options.shm_name = values[++i];
+            } else if (arg == "--shm-slots" && i + 1 < count) {
+                options.shm_slots = std::atoi(values[++i]);
+            } else if (arg == "--shm-slot-size" && i + 1 < count) {
+                options.shm_slot_size = std::atoi(values[++i]);
+            } else if (arg == "--dedupe" && i + 1 < count) {
+                options.dedupe_threshold = std::atof(values[++i]);
+            } else if (arg == "--match-tolerance" && i + 1 < count) {
+                options.match_tolerance_ms = std::strtoll(values[++i], nullptr, 10);
+            } else if (arg == "--time-range" && i + 1 < count) {
+                std::string range = values[++i];
+                size_t colon = range.find(':');
+                if (colon == std::string::npos) {
+                    std::cerr << "无效的时间范围: " << range << " (格式 BEGIN:END)" << std::endl;
+                    return 1;
+                }
+                std::string begin = range.substr(0, colon);
+                std::string end = range.substr(colon + 1);
+                if (!begin.empty()) options.select_begin_ms = std::strtoll(begin.c_str(), nullptr, 10);
+                if (!end.empty()) options.select_end_ms = std::strtoll(end.c_str(), nullptr, 10);
+            } else {
+                std::cerr << "未知参数: " << arg << std::endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        return 0;
+    };
+    if (int status = parse_args(argc - 1, argv + 1)) {
+        return status;
+    }
+    if (options.jpeg_backend == "gpu" && options.hwaccel.empty()) {
+        std::cout << "未启用 --hwaccel，gpu JPEG 编码后端将使用 CPU 编码" << std::endl;
+    }
+    if (options.output_compression != "none" &&
+        !is_raw_output_format(selected_output_format(options).format)) {
+        std::cerr << "--compress 只适用于原始输出格式 (yuv420p/nv12/rgb24/gbrp)" << std::endl;
+        return 1;
+    }
+
+    // 按配置生成摄像头任务，每个数据盘(会话)一组；批处理时再按时间切分
+    const bool grouped = options.group_mode != "none";
+    if (!options.shm_name.empty() && (grouped || !options.profiles.empty())) {
+        std::cerr << "--publish-shm 不能与 --group 或 --profile 同时使用" << std::endl;
+        return 1;
+    }
+    if (grouped && !options.profiles.empty()) {
+        // 同步分组时各路帧交给分组器，不经过输出配置的流水线
+        std::cerr << "--profile 不能与 --group 同时使用" << std::endl;
+        return 1;
+    }
+    if (grouped && options.resume) {
+        // 同步分组的输出(surround 目录及其打包文件)每次重新生成，不支持断点续传
+        std::cerr << "--resume 不能与 --group 同时使用" << std::endl;
+        return 1;
+    }
+    if (split_ms > 0 && (grouped || options.pack_output || !options.select_timestamps.empty() ||
+                         options.dedupe_threshold > 0.0 || !options.shm_name.empty())) {
+        std::cerr << "按时间切分任务不能与 --group、--pack、--timestamps、--dedupe 或 --publish-shm 同时使用，不切分"
+                  << std::endl;
+        split_ms = 0;
+    }
+    if (options.segment_workers > 1 && options.dedupe_threshold > 0.0) {
+        // 去重需要按时间顺序比较相邻帧，分段并行解码时做不到
+        std::cerr << "--segment-workers 不能与 --dedupe 同时使用，改为顺序解码" << std::endl;
+        options.segment_workers = 1;
+    }
+    std::string missing = missing_job_paths(jobs_config, options.shm_name.empty());
+    if (!missing.empty()) {
+        std::cerr << "缺少 " << missing << " (没有默认目录)" << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::vector<std::vector<CameraJob>> job_groups = build_camera_jobs(jobs_config);
+    std::vector<CameraJob> cameras;
+    std::vector<size_t> camera_session;  // 每个任务所属的会话，用于分配给工作线程
+    for (size_t g = 0; g < job_groups.size(); g++) {
+        for (auto& task : split_camera_jobs(job_groups[g], split_ms)) {
+            cameras.push_back(std::move(task));
+            camera_session.push_back(g);
+        }
+    }
+    if (cameras.empty()) {
+        std::cerr << "没有要处理的摄像头" << (jobs_config.drives.empty() ? "" : "，没有匹配的数据盘目录: ")
+                  << jobs_config.drives << std::endl;
+        return 1;
+    }
+    if (job_groups.size() > 1 || split_ms > 0) {
+        std::cout << "批处理: " << job_groups.size() << " 个会话, " << cameras.size() << " 个任务" << std::endl;
+    }
+    init_ffmpeg_once();
+
+    if (jobs <= 0) {
+        jobs = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    jobs = std::min(jobs, static_cast<int>(cameras.size()));
+    if (grouped) {
+        // 同步分组需要一组内的摄像头同时解码，各数据盘依次处理
+        jobs = static_cast<int>(jobs_config.cameras.size());
+    }
+
+    // 按并行摄像头数划分 CPU，避免各路视频流的 FFmpeg 内部线程超额订阅
+    int cpu_count = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int per_stream_cpus = std::max(1, cpu_count / jobs);
+    if (options.decode_threads <= 0) {
+        int pool_threads = options.queue_depth > 0 ? std::max(1, options.encode_threads) : 0;
+        if (!options.calibration_dir.empty()) {
+            pool_threads += options.remap_threads - 1;  // 转换线程自己处理一段
+        }
+        // 分段并行解码时每个段解码器分到一份
+        options.decode_threads = std::max(1, (per_stream_cpus - pool_threads) / options.segment_workers);
+    }
+    std::cout << "线程配置: CPU " << cpu_count << ", 并行摄像头 " << jobs
+              << ", 每路解码线程 " << options.decode_threads << " (" << options.decode_thread_type << ")"
+              << (options.segment_workers > 1 ? " x 分段 " + std::to_string(options.segment_workers) : "")
+              << ", 编码线程 " << (options.queue_depth > 0 ? std::max(1, options.encode_threads) : 0)
+              << " x 切片线程 " << std::max(1, options.jpeg_threads) << std::endl;
+
+    std::unique_ptr<MemoryBudget> memory_budget;
+    if (memory_budget_mb > 0) {
+        memory_budget = std::make_unique<MemoryBudget>(static_cast<size_t>(memory_budget_mb) << 20);
+        options.memory_budget = memory_budget.get();
+        std::cout << "内存预算: " << memory_budget_mb << " MB" << std::endl;
+    }
+
+    std::vector<CameraResult> results(cameras.size());
+    std::vector<std::unique_ptr<StreamStats>> stats(cameras.size());
+    for (size_t i = 0; i < cameras.size(); i++) {
+        stats[i] = std::make_unique<StreamStats>();
+        stats[i]->camera = cameras[i].name;
+    }
+    // 同步分组的编码和写入统计按数据盘单独列在最后
+    if (grouped) {
+        for (const auto& group : job_groups) {
+            stats.push_back(std::make_unique<StreamStats>());
+            // 多个数据盘或会话时按输出目录区分各组
+            stats.back()->camera = job_groups.size() > 1
+                                       ? group[0].output_dir.parent_path().filename().string() + "/surround"
+                                       : "surround";
+        }
+    }
+    auto run_task = [&](size_t idx) {
+        auto start = std::chrono::steady_clock::now();
+        stats[idx]->start = start;
+        stats[idx]->started = true;
+        results[idx].prefix = cameras[idx].name;
+        results[idx].success = process_camera(cameras[idx], options, stats[idx].get());
+        results[idx].seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        stats[idx]->seconds = results[idx].seconds;
+        stats[idx]->success = results[idx].success;
+    };
+
+    auto total_start = std::chrono::steady_clock::now();
+
+    // 定时输出进度
+    std::mutex progress_mutex;
+    std::condition_variable progress_cv;
+    bool progress_stop = false;
+    std::thread progress_thread;
+    if (stats_interval > 0) {
+        progress_thread = std::thread([&]() {
+            std::unique_lock<std::mutex> lock(progress_mutex);
+            auto interval = std::chrono::duration<double>(stats_interval);
+            while (!progress_cv.wait_for(lock, interval, [&] { return progress_stop; })) {
+                std::ostringstream line;
+                line << "{\"type\":\"progress\",\"elapsed\":"
+                     << std::chrono::duration<double>(std::chrono::steady_clock::now() - total_start).count()
+                     << ",\"cameras\":[";
+                // 批处理时任务很多，只打印正在运行的任务
+                size_t completed = 0;
+                bool first = true;
+                for (size_t i = 0; i < stats.size(); i++) {
+                    if (stats[i]->seconds > 0) {
+                        completed++;
+                        continue;
+                    }
+                    if (!stats[i]->started) {
+                        continue;
+                    }
+                    line << (first ? "" : ",");
+                    first = false;
+                    write_stream_stats_json(line, *stats[i], false);
+                }
+                line << "],\"completed\":" << completed << ",\"total\":" << stats.size() << "}";
+                std::cout << line.str() << std::endl;
+            }
+        });
+    }
+
+    bool group_success = true;
+    if (grouped) {
+        size_t first = 0;
+        for (size_t g = 0; g < job_groups.size(); g++) {
+            const auto& group = job_groups[g];
+            std::vector<StreamStats*> camera_stats;
+            std::vector<CameraResult> group_results(group.size());
+            for (size_t i = 0; i < group.size(); i++) {
+                camera_stats.push_back(stats[first + i].get());
+                group_results[i].prefix = group[i].name;
+            }
+            std::string output_dir = (group[0].output_dir.parent_path() / "surround").string();
+            if (!process_camera_group(group, output_dir, options, camera_stats,
+                                      stats[cameras.size() + g].get(), group_results)) {
+                group_success = false;
+            }
+            std::copy(group_results.begin(), group_results.end(), results.begin() + first);
+            first += group.size();
+        }
+    } else {
+        // 每个工作线程使用各自独立的解码/编码上下文，任务跨会话调度
+        std::vector<std::function<void()>> tasks;
+        for (size_t idx = 0; idx < cameras.size(); idx++) {
+            tasks.push_back([&run_task, idx] { run_task(idx); });
+        }
+        WorkStealingPool pool(jobs);
+        pool.run(std::move(tasks), camera_session);
+        if (pool.steals() > 0) {
+            std::cout << "工作线程间窃取任务 " << pool.steals() << " 次" << std::endl;
+        }
+    }
+    double total_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - total_start).count();
+
+    if (progress_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            progress_stop = true;
+        }
+        progress_cv.notify_all();
+        progress_thread.join();
+    }
+
+    const size_t peak_rss = peak_rss_bytes();
+    std::cout << "峰值内存 (RSS): " << peak_rss / (1024 * 1024) << " MB";
+    if (memory_budget) {
+        std::cout << ", 预算峰值占用 " << memory_budget->peak() / (1024 * 1024) << " / "
+                  << memory_budget->capacity() / (1024 * 1024) << " MB";
+    }
+    std::cout << std::endl;
+
+    size_t failed = 0;
+    for (const auto& result : results) {
+        failed += result.success ? 0 : 1;
+    }
+    int exit_code = 0;
+    if (failed > 0 && failed == results.size()) {
+        exit_code = 3;
+    } else if (failed > 0 || !group_success) {
+        exit_code = 2;
+    }
+
+    // 机器可读的运行报告
+    if (!stats_json_path.empty()) {
+        std::ostringstream report;
+        report << "{\"type\":\"report\",\"total_seconds\":" << total_seconds
+               << ",\"jobs\":" << jobs << ",\"peak_rss_bytes\":" << peak_rss;
+        if (memory_budget) {
+            report << ",\"memory_budget_bytes\":" << memory_budget->capacity()
+                   << ",\"memory_budget_peak_bytes\":" << memory_budget->peak();
+        }
+        report << ",\"exit_code\":" << exit_code << ",\"failed\":[";
+        bool first_failed = true;
+        for (const auto& result : results) {
+            if (!result.success) {
+                report << (first_failed ? "" : ",") << "\"" << json_escape(result.prefix) << "\"";
+                first_failed = false;
+            }
+        }
+        report << "],\"cameras\":[";
+        for (size_t i = 0; i < stats.size(); i++) {
+            report << (i ? "," : "");
+            write_stream_stats_json(report, *stats[i], true);
+        }
+        report << "]}\n";
+        if (stats_json_path == "-") {
+            std::cout << report.str();
+        } else {
+            std::ofstream out(stats_json_path);
+            out << report.str();
+            if (!out) {
+                std::cerr << "无法写入统计报告: " << stats_json_path << std::endl;
+            }
         }
     }
+
+    // 汇总每个摄像头的处理状态
+    // 批处理任务很多时只列出失败的任务
+    const bool list_all = results.size() <= 64;
+    for (const auto& result : results) {
+        if (list_all || !result.success) {
+            std::cout << (result.success ? "[成功] " : "[失败] ") << result.prefix
+                      << " 用时 " << result.seconds << " 秒" << std::endl;
+        }
+    }
+    if (!list_all) {
+        std::cout << "任务 " << results.size() << " 个，失败 " << failed << " 个" << std::endl;
+    }
+    std::cout << "总用时 " << total_seconds << " 秒 (并行数 " << jobs << ")" << std::endl;
     
-    if (all_success) {
+    if (exit_code == 0) {
         std::cout << "所有摄像头视频处理成功!" << std::endl;
     } else {
         std::cerr << "部分摄像头视频处理失败，请查看错误信息了解详情。" << std::endl;
     }
 
-    return 0;
+    return exit_code;
 }
+#endif  // RESTORE_NO_MAIN